@@ -0,0 +1,376 @@
+#include "ChaCha20Poly1305.h"
+
+#include <cstring>
+
+namespace Intercom {
+
+// Four ChaCha20 blocks are computed side by side, one per vector lane. The GCC/Clang vector
+// extension lowers this to SSE2 on x86-64 and NEON on arm64 without per-platform intrinsics.
+typedef uint32_t u32x4 __attribute__((vector_size(16)));
+__extension__ typedef unsigned __int128 uint128_t;
+
+static constexpr uint32_t kSigma[4] = { 0x61707865, 0x3320646e, 0x79622d32, 0x6b206574 }; // "expand 32-byte k"
+static constexpr size_t kBlockSize = 64;
+static constexpr size_t kParallelBlocks = 4;
+
+static inline uint32_t load32_le(const uint8_t* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void store32_le(uint8_t* p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static inline uint64_t load64_le(const uint8_t* p)
+{
+    return (uint64_t)load32_le(p) | ((uint64_t)load32_le(p + 4) << 32);
+}
+
+static inline void store64_le(uint8_t* p, uint64_t v)
+{
+    store32_le(p, (uint32_t)v);
+    store32_le(p + 4, (uint32_t)(v >> 32));
+}
+
+void secure_zero(void* p, size_t length)
+{
+    volatile uint8_t* bytes = static_cast<volatile uint8_t*>(p);
+    while (length--) {
+        *bytes++ = 0;
+    }
+}
+
+template <typename T>
+static inline T rotl(T v, int n)
+{
+    return (v << n) | (v >> (32 - n));
+}
+
+template <typename T>
+static inline void quarter_round(T& a, T& b, T& c, T& d)
+{
+    a += b;
+    d = rotl(d ^ a, 16);
+    c += d;
+    b = rotl(b ^ c, 12);
+    a += b;
+    d = rotl(d ^ a, 8);
+    c += d;
+    b = rotl(b ^ c, 7);
+}
+
+template <typename T>
+static inline void chacha20_rounds(T x[16])
+{
+    for (int i = 0; i < 10; i++) {
+        quarter_round(x[0], x[4], x[8], x[12]);
+        quarter_round(x[1], x[5], x[9], x[13]);
+        quarter_round(x[2], x[6], x[10], x[14]);
+        quarter_round(x[3], x[7], x[11], x[15]);
+        quarter_round(x[0], x[5], x[10], x[15]);
+        quarter_round(x[1], x[6], x[11], x[12]);
+        quarter_round(x[2], x[7], x[8], x[13]);
+        quarter_round(x[3], x[4], x[9], x[14]);
+    }
+}
+
+static void chacha20_block(const uint32_t key[8], const uint8_t nonce[12], uint32_t counter, uint8_t out[kBlockSize])
+{
+    uint32_t in[16];
+    memcpy(in, kSigma, sizeof(kSigma));
+    memcpy(in + 4, key, 8 * sizeof(uint32_t));
+    in[12] = counter;
+    for (int i = 0; i < 3; i++) {
+        in[13 + i] = load32_le(nonce + (4 * i));
+    }
+
+    uint32_t x[16];
+    memcpy(x, in, sizeof(in));
+    chacha20_rounds(x);
+    for (int i = 0; i < 16; i++) {
+        store32_le(out + (4 * i), x[i] + in[i]);
+    }
+    secure_zero(x, sizeof(x));
+}
+
+static void chacha20_blocks4(const uint32_t key[8], const uint8_t nonce[12], uint32_t counter,
+    uint8_t out[kBlockSize * kParallelBlocks])
+{
+    u32x4 in[16];
+    for (int i = 0; i < 4; i++) {
+        in[i] = u32x4 { kSigma[i], kSigma[i], kSigma[i], kSigma[i] };
+    }
+    for (int i = 0; i < 8; i++) {
+        in[4 + i] = u32x4 { key[i], key[i], key[i], key[i] };
+    }
+    in[12] = u32x4 { counter, counter + 1, counter + 2, counter + 3 };
+    for (int i = 0; i < 3; i++) {
+        const uint32_t n = load32_le(nonce + (4 * i));
+        in[13 + i] = u32x4 { n, n, n, n };
+    }
+
+    u32x4 x[16];
+    memcpy(x, in, sizeof(in));
+    chacha20_rounds(x);
+    for (int i = 0; i < 16; i++) {
+        x[i] += in[i];
+        for (size_t lane = 0; lane < kParallelBlocks; lane++) {
+            store32_le(out + (lane * kBlockSize) + (4 * i), x[i][lane]);
+        }
+    }
+    secure_zero(x, sizeof(x));
+}
+
+static void chacha20_xor(const uint32_t key[8], const uint8_t nonce[12], uint32_t counter, uint8_t* data, size_t length)
+{
+    uint8_t keystream[kBlockSize * kParallelBlocks];
+    while (length > 0) {
+        chacha20_blocks4(key, nonce, counter, keystream);
+        const size_t n = length < sizeof(keystream) ? length : sizeof(keystream);
+        for (size_t i = 0; i < n; i++) {
+            data[i] ^= keystream[i];
+        }
+        counter += kParallelBlocks;
+        data += n;
+        length -= n;
+    }
+    secure_zero(keystream, sizeof(keystream));
+}
+
+void hchacha20(const uint8_t key[ChaCha20Poly1305::kKeySize], const uint8_t input[16],
+    uint8_t out[ChaCha20Poly1305::kKeySize])
+{
+    uint32_t x[16];
+    memcpy(x, kSigma, sizeof(kSigma));
+    for (int i = 0; i < 8; i++) {
+        x[4 + i] = load32_le(key + (4 * i));
+    }
+    for (int i = 0; i < 4; i++) {
+        x[12 + i] = load32_le(input + (4 * i));
+    }
+    chacha20_rounds(x);
+    for (int i = 0; i < 4; i++) {
+        store32_le(out + (4 * i), x[i]);
+        store32_le(out + 16 + (4 * i), x[12 + i]);
+    }
+    secure_zero(x, sizeof(x));
+}
+
+// Poly1305 with 44/44/42-bit limbs and 128-bit products (the "donna-64" layout).
+class Poly1305 {
+    static constexpr uint64_t kMask44 = 0xfffffffffff;
+    static constexpr uint64_t kMask42 = 0x3ffffffffff;
+
+    uint64_t m_r[3];
+    uint64_t m_h[3];
+    uint64_t m_pad[2];
+    uint8_t m_buffer[16];
+    size_t m_buffered;
+
+    void blocks(const uint8_t* m, size_t length, uint64_t hibit)
+    {
+        const uint64_t r0 = m_r[0], r1 = m_r[1], r2 = m_r[2];
+        const uint64_t s1 = r1 * (5 << 2), s2 = r2 * (5 << 2);
+        uint64_t h0 = m_h[0], h1 = m_h[1], h2 = m_h[2];
+
+        while (length >= 16) {
+            const uint64_t t0 = load64_le(m);
+            const uint64_t t1 = load64_le(m + 8);
+            h0 += t0 & kMask44;
+            h1 += ((t0 >> 44) | (t1 << 20)) & kMask44;
+            h2 += ((t1 >> 24) & kMask42) | hibit;
+
+            const uint128_t d0 = (uint128_t)h0 * r0 + (uint128_t)h1 * s2 + (uint128_t)h2 * s1;
+            uint128_t d1 = (uint128_t)h0 * r1 + (uint128_t)h1 * r0 + (uint128_t)h2 * s2;
+            uint128_t d2 = (uint128_t)h0 * r2 + (uint128_t)h1 * r1 + (uint128_t)h2 * r0;
+
+            uint64_t c = (uint64_t)(d0 >> 44);
+            h0 = (uint64_t)d0 & kMask44;
+            d1 += c;
+            c = (uint64_t)(d1 >> 44);
+            h1 = (uint64_t)d1 & kMask44;
+            d2 += c;
+            c = (uint64_t)(d2 >> 42);
+            h2 = (uint64_t)d2 & kMask42;
+            h0 += c * 5;
+            c = h0 >> 44;
+            h0 &= kMask44;
+            h1 += c;
+
+            m += 16;
+            length -= 16;
+        }
+        m_h[0] = h0;
+        m_h[1] = h1;
+        m_h[2] = h2;
+    }
+
+public:
+    explicit Poly1305(const uint8_t key[32])
+        : m_h {}
+        , m_buffered(0)
+    {
+        const uint64_t t0 = load64_le(key);
+        const uint64_t t1 = load64_le(key + 8);
+        m_r[0] = t0 & 0xffc0fffffff;
+        m_r[1] = ((t0 >> 44) | (t1 << 20)) & 0xfffffc0ffff;
+        m_r[2] = (t1 >> 24) & 0x00ffffffc0f;
+        m_pad[0] = load64_le(key + 16);
+        m_pad[1] = load64_le(key + 24);
+    }
+
+    ~Poly1305()
+    {
+        secure_zero(m_r, sizeof(m_r));
+        secure_zero(m_pad, sizeof(m_pad));
+    }
+
+    void update(const uint8_t* m, size_t length)
+    {
+        if (length == 0) {
+            return;
+        }
+        if (m_buffered > 0) {
+            const size_t n = length < 16 - m_buffered ? length : 16 - m_buffered;
+            memcpy(m_buffer + m_buffered, m, n);
+            m_buffered += n;
+            m += n;
+            length -= n;
+            if (m_buffered < 16) {
+                return;
+            }
+            blocks(m_buffer, 16, 1ULL << 40);
+            m_buffered = 0;
+        }
+        const size_t whole = length & ~(size_t)15;
+        blocks(m, whole, 1ULL << 40);
+        memcpy(m_buffer, m + whole, length - whole);
+        m_buffered = length - whole;
+    }
+
+    // The AEAD construction zero-pads each section to a block boundary.
+    void pad16()
+    {
+        if (m_buffered > 0) {
+            memset(m_buffer + m_buffered, 0, 16 - m_buffered);
+            blocks(m_buffer, 16, 1ULL << 40);
+            m_buffered = 0;
+        }
+    }
+
+    void finish(uint8_t tag[16])
+    {
+        if (m_buffered > 0) {
+            m_buffer[m_buffered] = 1;
+            memset(m_buffer + m_buffered + 1, 0, 16 - m_buffered - 1);
+            blocks(m_buffer, 16, 0);
+        }
+
+        uint64_t h0 = m_h[0], h1 = m_h[1], h2 = m_h[2];
+        uint64_t c = h1 >> 44;
+        h1 &= kMask44;
+        h2 += c;
+        c = h2 >> 42;
+        h2 &= kMask42;
+        h0 += c * 5;
+        c = h0 >> 44;
+        h0 &= kMask44;
+        h1 += c;
+        c = h1 >> 44;
+        h1 &= kMask44;
+        h2 += c;
+        c = h2 >> 42;
+        h2 &= kMask42;
+        h0 += c * 5;
+        c = h0 >> 44;
+        h0 &= kMask44;
+        h1 += c;
+
+        // Compute h - p and keep it if it didn't underflow, without branching on secret data.
+        uint64_t g0 = h0 + 5;
+        c = g0 >> 44;
+        g0 &= kMask44;
+        uint64_t g1 = h1 + c;
+        c = g1 >> 44;
+        g1 &= kMask44;
+        uint64_t g2 = h2 + c - (1ULL << 42);
+        const uint64_t keep_g = (g2 >> 63) - 1;
+        h0 = (h0 & ~keep_g) | (g0 & keep_g);
+        h1 = (h1 & ~keep_g) | (g1 & keep_g);
+        h2 = (h2 & ~keep_g) | (g2 & keep_g);
+
+        const uint64_t t0 = m_pad[0], t1 = m_pad[1];
+        h0 += t0 & kMask44;
+        c = h0 >> 44;
+        h0 &= kMask44;
+        h1 += (((t0 >> 44) | (t1 << 20)) & kMask44) + c;
+        c = h1 >> 44;
+        h1 &= kMask44;
+        h2 += ((t1 >> 24) & kMask42) + c;
+        h2 &= kMask42;
+
+        store64_le(tag, h0 | (h1 << 44));
+        store64_le(tag + 8, (h1 >> 20) | (h2 << 24));
+    }
+};
+
+static void compute_tag(const uint32_t key[8], const uint8_t nonce[12], const uint8_t* aad, size_t aad_length,
+    const uint8_t* ciphertext, size_t length, uint8_t tag[16])
+{
+    uint8_t block0[kBlockSize];
+    chacha20_block(key, nonce, 0, block0);
+    Poly1305 mac(block0);
+    secure_zero(block0, sizeof(block0));
+
+    mac.update(aad, aad_length);
+    mac.pad16();
+    mac.update(ciphertext, length);
+    mac.pad16();
+    uint8_t lengths[16];
+    store64_le(lengths, aad_length);
+    store64_le(lengths + 8, length);
+    mac.update(lengths, sizeof(lengths));
+    mac.finish(tag);
+}
+
+ChaCha20Poly1305::ChaCha20Poly1305(const uint8_t key[kKeySize])
+{
+    for (int i = 0; i < 8; i++) {
+        m_key[i] = load32_le(key + (4 * i));
+    }
+}
+
+ChaCha20Poly1305::~ChaCha20Poly1305()
+{
+    secure_zero(m_key, sizeof(m_key));
+}
+
+void ChaCha20Poly1305::seal(const uint8_t nonce[kNonceSize], const uint8_t* aad, size_t aad_length, uint8_t* data,
+    size_t length, uint8_t tag[kTagSize]) const
+{
+    chacha20_xor(m_key, nonce, 1, data, length);
+    compute_tag(m_key, nonce, aad, aad_length, data, length, tag);
+}
+
+bool ChaCha20Poly1305::open(const uint8_t nonce[kNonceSize], const uint8_t* aad, size_t aad_length, uint8_t* data,
+    size_t length, const uint8_t tag[kTagSize]) const
+{
+    uint8_t expected[kTagSize];
+    compute_tag(m_key, nonce, aad, aad_length, data, length, expected);
+    uint8_t diff = 0;
+    for (size_t i = 0; i < kTagSize; i++) {
+        diff |= expected[i] ^ tag[i];
+    }
+    if (diff != 0) {
+        return false;
+    }
+    chacha20_xor(m_key, nonce, 1, data, length);
+    return true;
+}
+
+} // namespace Intercom
@@ -0,0 +1,34 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+namespace Intercom {
+
+// RFC 8439 AEAD. Encryption and decryption work in place so frames never leave their buffers.
+class ChaCha20Poly1305 {
+public:
+    static constexpr size_t kKeySize = 32;
+    static constexpr size_t kNonceSize = 12;
+    static constexpr size_t kTagSize = 16;
+
+private:
+    uint32_t m_key[8];
+
+public:
+    explicit ChaCha20Poly1305(const uint8_t key[kKeySize]);
+    ~ChaCha20Poly1305();
+
+    void seal(const uint8_t nonce[kNonceSize], const uint8_t* aad, size_t aad_length, uint8_t* data, size_t length,
+        uint8_t tag[kTagSize]) const;
+    // Leaves data untouched and returns false if the tag doesn't match.
+    bool open(const uint8_t nonce[kNonceSize], const uint8_t* aad, size_t aad_length, uint8_t* data, size_t length,
+        const uint8_t tag[kTagSize]) const;
+};
+
+// Wipes key material in a way the compiler can't optimise away.
+void secure_zero(void* p, size_t length);
+
+// Derives a subkey from a key and 16 bytes of input (the XChaCha20 construction). Used as a KDF.
+void hchacha20(const uint8_t key[ChaCha20Poly1305::kKeySize], const uint8_t input[16],
+    uint8_t out[ChaCha20Poly1305::kKeySize]);
+}
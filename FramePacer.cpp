@@ -0,0 +1,310 @@
+#include "FramePacer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <stdio.h>
+
+namespace Intercom {
+
+static constexpr auto kReportInterval = std::chrono::milliseconds(200);
+static constexpr auto kStatsInterval = std::chrono::milliseconds(200);
+static constexpr auto kTimestampInterval = std::chrono::milliseconds(50);
+static constexpr auto kPeerReportTimeout = 3 * kStatsInterval;
+static constexpr auto kKeepaliveInterval = std::chrono::seconds(1);
+static constexpr auto kIdleWait = std::chrono::milliseconds(1);
+static constexpr int kPollTimeoutMs = 10;
+static constexpr int kUnsentLimit = 4096; // about two audio frames
+
+FramePacer::FramePacer(const TcpConnection& connection, RateController& controller, SecureSession& session,
+    LinkStats& stats)
+    : m_connection(connection)
+    , m_controller(controller)
+    , m_session(session)
+    , m_stats(stats)
+    , m_queue(std::make_unique<Chunk[]>(kQueueDepth))
+    , m_head(0)
+    , m_tail(0)
+    , m_running(false)
+    , m_dropped(0)
+    , m_error(0)
+    , m_control_head(0)
+    , m_control_count(0)
+    , m_bytes_since_report(0)
+    , m_writes_since_report(0)
+    , m_last_reported_frames(0)
+    , m_last_retransmits(0)
+    , m_last_delay_ms(0)
+    , m_blocked_ms(0)
+{
+}
+
+FramePacer::~FramePacer()
+{
+    stop();
+}
+
+void FramePacer::start()
+{
+    if (m_running.exchange(true)) {
+        return;
+    }
+    if (!m_connection.set_unsent_limit(kUnsentLimit)) {
+        fprintf(stderr, "FramePacer - Can't limit unsent data, latency may build up in the kernel\n");
+    }
+    if (auto info = m_connection.transport_info(); info) {
+        m_last_retransmits = info->total_retransmits;
+        m_last_delay_ms = info->rtt_us / 2000.0;
+    }
+    m_thread = std::thread([this] { run(); });
+}
+
+void FramePacer::stop()
+{
+    m_running = false;
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+bool FramePacer::push(const uint8_t* data, size_t length)
+{
+    if (length > kMaxChunkSize) {
+        return false;
+    }
+    const uint64_t tail = m_tail.load(std::memory_order_relaxed);
+    if (tail - m_head.load(std::memory_order_acquire) >= kQueueDepth) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        return false; // Sender is behind, don't block the audio thread
+    }
+    Chunk& chunk = m_queue[tail % kQueueDepth];
+    chunk.enqueued = Clock::now();
+    chunk.length = length;
+    memcpy(chunk.buffer + kControlRoom + kFrameHeaderSize, data, length);
+    m_tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+bool FramePacer::post_control(const ControlMessage& message)
+{
+    std::lock_guard<std::mutex> lock(m_control_mutex);
+    if (m_control_count == kControlQueueDepth) {
+        return false;
+    }
+    ControlSlot& slot = m_controls[(m_control_head + m_control_count) % kControlQueueDepth];
+    slot.length = encode_control(message, slot.payload);
+    m_control_count++;
+    return true;
+}
+
+void FramePacer::run()
+{
+    m_next_send = Clock::now();
+    m_last_report = m_next_send;
+    m_last_stats = m_next_send;
+    m_last_write = m_next_send;
+    m_last_timestamp = m_next_send;
+    while (m_running) {
+        const auto now = Clock::now();
+        if (now - m_last_report >= kReportInterval) {
+            update_controller(now);
+        }
+        post_periodic(now);
+
+        const uint64_t head = m_head.load(std::memory_order_relaxed);
+        if (head != m_tail.load(std::memory_order_acquire)) {
+            Chunk& chunk = m_queue[head % kQueueDepth];
+            const double queued_ms = std::chrono::duration<double, std::milli>(now - chunk.enqueued).count();
+            if (queued_ms > m_controller.queue_budget_ms()) {
+                // Too late to be useful, sending it would only delay everything behind it.
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                m_head.store(head + 1, std::memory_order_release);
+                continue;
+            }
+
+            if (now >= m_next_send) {
+                if (!wait_writable(0)) {
+                    // The kernel already holds its share; keep the chunk here where it can expire.
+                    wait_writable(1);
+                    continue;
+                }
+                if (!send_audio(chunk)) {
+                    m_running = false;
+                    break;
+                }
+                m_head.store(head + 1, std::memory_order_release);
+
+                // Space chunks evenly at the target bitrate instead of letting them leave in bursts.
+                const size_t wire_size = chunk.length + kFrameOverhead;
+                const std::chrono::duration<double> interval(wire_size * 8.0 / m_controller.target_bitrate());
+                m_next_send = std::max(now, m_next_send) + std::chrono::duration_cast<Clock::duration>(interval);
+                continue;
+            }
+        }
+
+        // No audio is due; don't hold control back waiting for it.
+        if (const size_t length = seal_controls(); length > 0) {
+            if (!send(m_control_frames, length)) {
+                m_running = false;
+                break;
+            }
+            continue;
+        }
+
+        if (head != m_tail.load(std::memory_order_acquire)) {
+            std::this_thread::sleep_until(std::min(m_next_send, now + kIdleWait));
+        } else {
+            std::this_thread::sleep_for(kIdleWait);
+        }
+    }
+}
+
+size_t FramePacer::seal_controls()
+{
+    std::lock_guard<std::mutex> lock(m_control_mutex);
+    size_t length = 0;
+    while (m_control_count > 0) {
+        const ControlSlot& slot = m_controls[m_control_head];
+        if (length + slot.length + kFrameOverhead > kControlRoom) {
+            break; // The rest go with the next write
+        }
+        uint8_t* frame = m_control_frames + length;
+        memcpy(frame + kFrameHeaderSize, slot.payload, slot.length);
+        length += seal_frame(m_session, Channel::Control, frame, slot.length);
+        m_control_head = (m_control_head + 1) % kControlQueueDepth;
+        m_control_count--;
+    }
+    return length;
+}
+
+bool FramePacer::send_audio(Chunk& chunk)
+{
+    const auto now = Clock::now();
+    if (now - m_last_timestamp >= kTimestampInterval) {
+        m_last_timestamp = now;
+        ControlMessage timestamp {};
+        timestamp.type = ControlType::Timestamp;
+        timestamp.sent_us = std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count();
+        post_control(timestamp);
+    }
+
+    // Controls are sealed first so their sequence numbers come before the audio frame's, matching
+    // the order they appear on the wire. They're then copied into the headroom right in front of it.
+    const size_t control_length = seal_controls();
+    uint8_t* frame = chunk.buffer + kControlRoom;
+    const size_t audio_length = seal_frame(m_session, Channel::Audio, frame, chunk.length);
+    memcpy(frame - control_length, m_control_frames, control_length);
+    return send(frame - control_length, control_length + audio_length);
+}
+
+bool FramePacer::send(const uint8_t* data, size_t length)
+{
+    size_t offset = 0;
+    while (offset < length) {
+        auto [written, err] = m_connection.write(data + offset, length - offset);
+        offset += written;
+        if (err == 0) {
+            break;
+        }
+        if (err == EPIPE || err == ECONNRESET) {
+            printf("FramePacer - Peer closed the connection\n");
+            m_error = err;
+            return false;
+        }
+        if (err != EWOULDBLOCK && err != EAGAIN && err != EINTR) {
+            fprintf(stderr, "FramePacer - Failed to send: %s\n", strerror(err));
+            m_error = err;
+            return false;
+        }
+        if (!m_running) {
+            return false;
+        }
+        // Kernel send buffer is full; wait for room rather than spinning.
+        wait_writable(kPollTimeoutMs);
+    }
+    m_last_write = Clock::now();
+    m_bytes_since_report += length;
+    m_writes_since_report++;
+    return true;
+}
+
+bool FramePacer::wait_writable(int timeout_ms)
+{
+    const auto blocked_since = Clock::now();
+    pollfd pfd { m_connection.socket(), POLLOUT, 0 };
+    const bool writable = ::poll(&pfd, 1, timeout_ms) > 0;
+    m_blocked_ms += std::chrono::duration<double, std::milli>(Clock::now() - blocked_since).count();
+    return writable;
+}
+
+void FramePacer::post_periodic(Clock::time_point now)
+{
+    if (now - m_last_stats >= kStatsInterval) {
+        m_last_stats = now;
+        ControlMessage stats {};
+        stats.type = ControlType::Stats;
+        stats.jitter_us = m_stats.local.jitter_us.load(std::memory_order_relaxed);
+        // Start a new interval for the receive thread's running minimum.
+        stats.delay_us = m_stats.local.delay_us.exchange(UINT32_MAX, std::memory_order_relaxed);
+        if (stats.delay_us == UINT32_MAX) {
+            stats.delay_us = 0; // No Timestamps since the last report
+        }
+        // Nothing new to report while the peer is quiet.
+        const uint32_t frames = m_stats.frames_received.load(std::memory_order_relaxed);
+        if (frames != m_last_reported_frames) {
+            m_last_reported_frames = frames;
+            post_control(stats);
+        }
+    }
+    if (now - m_last_write >= kKeepaliveInterval) {
+        m_last_write = now; // Don't queue another one before this one is written
+        ControlMessage keepalive {};
+        keepalive.type = ControlType::Keepalive;
+        post_control(keepalive);
+    }
+}
+
+void FramePacer::update_controller(Clock::time_point now)
+{
+    m_last_report = now;
+    auto info = m_connection.transport_info();
+    if (!info) {
+        m_bytes_since_report = 0;
+        m_writes_since_report = 0;
+        return;
+    }
+
+    const double rtt_ms = info->rtt_us / 1000.0;
+    const uint32_t retransmits = info->total_retransmits - m_last_retransmits;
+    m_last_retransmits = info->total_retransmits;
+    // With TCP_NODELAY every write leaves in at least one segment, however large the MSS.
+    const double segments = std::max({ 1.0, (double)m_writes_since_report,
+        (double)m_bytes_since_report / std::max(1u, info->mss) });
+    m_bytes_since_report = 0;
+    m_writes_since_report = 0;
+
+    // The receiver's Stats only count while it's getting our audio; without them the queuing
+    // delay beyond our own TCP is unknown.
+    const int64_t now_us = std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count();
+    const int64_t report_age_us = now_us - m_stats.peer_report_us.load(std::memory_order_acquire);
+    const bool peer_fresh
+        = report_age_us < std::chrono::duration_cast<std::chrono::microseconds>(kPeerReportTimeout).count();
+    const double queuing_ms = peer_fresh ? m_stats.peer.delay_us.load(std::memory_order_relaxed) / 1000.0 : 0;
+    const double peer_jitter_ms = peer_fresh ? m_stats.peer.jitter_us.load(std::memory_order_relaxed) / 1000.0 : 0;
+
+    // Time spent waiting for the kernel to take more is queuing delay nobody has measured yet.
+    // Our own pacing queue is left out on purpose: it grows whenever we deliberately send slower.
+    const double delay_ms = (rtt_ms / 2) + queuing_ms + m_blocked_ms;
+    m_blocked_ms = 0;
+    FeedbackReport report {};
+    report.loss_fraction = std::min(1.0, retransmits / segments);
+    report.jitter_ms = std::max(info->rtt_var_us / 1000.0, peer_jitter_ms);
+    report.delay_gradient_ms = delay_ms - m_last_delay_ms;
+    report.rtt_ms = rtt_ms;
+    report.queuing_delay_ms = queuing_ms;
+    m_last_delay_ms = delay_ms;
+    m_controller.on_feedback(report);
+}
+
+} // namespace Intercom
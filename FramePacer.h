@@ -0,0 +1,100 @@
+#pragma once
+#include "FrameProtocol.h"
+#include "RateController.h"
+#include "SecureSession.h"
+#include "TcpConnection.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace Intercom {
+
+// Sits between the audio callback and the socket so the callback never blocks on the network.
+// push() copies a chunk into a lock-free single-producer queue; a sender thread paces chunks out at
+// the RateController's bitrate and drops the ones that have waited longer than the latency budget.
+// Chunks are framed and encrypted in place in their queue slot just before they're sent. The kernel
+// is only allowed a few frames of unsent data, so a backlog waits here where the budget applies.
+//
+// Control frames are never paced or dropped. Pending ones are sealed into headroom in front of
+// the next audio frame so both leave in one write; if no audio is due they go out on their own.
+// The pacer also sends our receive Stats and a Keepalive on a timer, and a Timestamp with audio so
+// the receiver can measure queuing delay and report it back in its Stats.
+class FramePacer {
+public:
+    static constexpr size_t kMaxChunkSize = kMaxAudioPayload;
+    static constexpr size_t kQueueDepth = 64;
+
+private:
+    static constexpr size_t kControlRoom = 256;
+    static constexpr size_t kControlQueueDepth = 16;
+    using Clock = std::chrono::steady_clock;
+    struct Chunk {
+        Clock::time_point enqueued;
+        size_t length;
+        uint8_t buffer[kControlRoom + kFrameOverhead + kMaxChunkSize]; // audio frame starts at kControlRoom
+    };
+    struct ControlSlot {
+        size_t length;
+        uint8_t payload[kMaxControlPayload];
+    };
+
+    const TcpConnection& m_connection;
+    RateController& m_controller;
+    SecureSession& m_session;
+    LinkStats& m_stats;
+    std::unique_ptr<Chunk[]> m_queue;
+    std::atomic<uint64_t> m_head; // next slot to send, owned by the sender thread
+    std::atomic<uint64_t> m_tail; // next slot to fill, owned by the audio callback
+    std::atomic<bool> m_running;
+    std::atomic<uint64_t> m_dropped;
+    std::atomic<int> m_error;
+    std::thread m_thread;
+
+    std::mutex m_control_mutex;
+    ControlSlot m_controls[kControlQueueDepth];
+    size_t m_control_head;
+    size_t m_control_count;
+
+    // Sender thread state
+    uint8_t m_control_frames[kControlRoom];
+    Clock::time_point m_next_send;
+    Clock::time_point m_last_write;
+    Clock::time_point m_last_stats;
+    Clock::time_point m_last_timestamp;
+    Clock::time_point m_last_report;
+    uint64_t m_bytes_since_report;
+    uint64_t m_writes_since_report;
+    uint32_t m_last_reported_frames;
+    uint32_t m_last_retransmits;
+    double m_last_delay_ms;
+    double m_blocked_ms;
+
+    void run();
+    size_t seal_controls();
+    bool send_audio(Chunk& chunk);
+    bool send(const uint8_t* data, size_t length);
+    bool wait_writable(int timeout_ms);
+    void post_periodic(Clock::time_point now);
+    void update_controller(Clock::time_point now);
+
+public:
+    FramePacer(const TcpConnection& connection, RateController& controller, SecureSession& session, LinkStats& stats);
+    ~FramePacer();
+    FramePacer(const FramePacer&) = delete;
+    FramePacer& operator=(const FramePacer&) = delete;
+
+    void start();
+    void stop();
+    // Safe to call from the real-time audio callback. Returns false if the chunk was dropped.
+    bool push(const uint8_t* data, size_t length);
+    // Queues a control message to go ahead of any audio. Not for the audio callback: it takes a lock.
+    bool post_control(const ControlMessage& message);
+    // Why the sender thread stopped on its own: EPIPE or ECONNRESET if the peer hung up, another
+    // errno if the write failed. 0 while sending or after stop().
+    int last_error() const { return m_error; }
+    uint64_t dropped_chunks() const { return m_dropped.load(std::memory_order_relaxed); }
+};
+}
@@ -0,0 +1,162 @@
+#include "FrameProtocol.h"
+
+#include <cerrno>
+#include <cstring>
+
+namespace Intercom {
+
+static void store32_le(uint8_t* p, uint32_t v)
+{
+    for (int i = 0; i < 4; i++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+static void store64_le(uint8_t* p, uint64_t v)
+{
+    for (int i = 0; i < 8; i++) {
+        p[i] = (uint8_t)(v >> (8 * i));
+    }
+}
+
+static uint64_t load64_le(const uint8_t* p)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < 8; i++) {
+        v |= (uint64_t)p[i] << (8 * i);
+    }
+    return v;
+}
+
+static uint32_t load32_le(const uint8_t* p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+size_t encode_control(const ControlMessage& message, uint8_t* out)
+{
+    out[0] = (uint8_t)message.type;
+    switch (message.type) {
+    case ControlType::Talk:
+        out[1] = message.talking ? 1 : 0;
+        return 2;
+    case ControlType::Keepalive:
+        return 1;
+    case ControlType::Stats:
+        store32_le(out + 1, message.jitter_us);
+        store32_le(out + 5, message.delay_us);
+        return 9;
+    case ControlType::AudioFormat:
+        store32_le(out + 1, message.format.sample_rate);
+        out[5] = message.format.channels;
+        out[6] = message.format.bits_per_sample;
+        return 7;
+    case ControlType::Timestamp:
+        store64_le(out + 1, message.sent_us);
+        return 9;
+    }
+    return 0;
+}
+
+std::optional<ControlMessage> decode_control(const uint8_t* payload, size_t length)
+{
+    if (length < 1) {
+        return std::nullopt;
+    }
+    ControlMessage message {};
+    message.type = (ControlType)payload[0];
+    switch (message.type) {
+    case ControlType::Talk:
+        if (length < 2) {
+            return std::nullopt;
+        }
+        message.talking = payload[1] != 0;
+        return message;
+    case ControlType::Keepalive:
+        return message;
+    case ControlType::Stats:
+        if (length < 9) {
+            return std::nullopt;
+        }
+        message.jitter_us = load32_le(payload + 1);
+        message.delay_us = load32_le(payload + 5);
+        return message;
+    case ControlType::AudioFormat:
+        if (length < 7) {
+            return std::nullopt;
+        }
+        message.format.sample_rate = load32_le(payload + 1);
+        message.format.channels = payload[5];
+        message.format.bits_per_sample = payload[6];
+        return message;
+    case ControlType::Timestamp:
+        if (length < 9) {
+            return std::nullopt;
+        }
+        message.sent_us = load64_le(payload + 1);
+        return message;
+    }
+    return std::nullopt; // Unknown type from a newer peer
+}
+
+size_t seal_frame(SecureSession& session, Channel channel, uint8_t* frame, size_t payload_length)
+{
+    frame[0] = kProtocolVersion;
+    frame[1] = (uint8_t)channel;
+    frame[2] = (uint8_t)(payload_length >> 8);
+    frame[3] = (uint8_t)payload_length;
+    session.seal(frame, kFrameHeaderSize, payload_length);
+    return payload_length + kFrameOverhead;
+}
+
+FrameParser::FrameParser()
+    : m_buffer(std::make_unique<uint8_t[]>(kBufferSize))
+    , m_start(0)
+    , m_end(0)
+{
+}
+
+int FrameParser::fill(const TcpConnection& connection)
+{
+    // Only a partial frame can be left over; move it to the front to make room.
+    if (m_start > 0) {
+        memmove(m_buffer.get(), m_buffer.get() + m_start, m_end - m_start);
+        m_end -= m_start;
+        m_start = 0;
+    }
+    auto [read, err] = connection.read_once(m_buffer.get() + m_end, kBufferSize - m_end);
+    if (err != 0) {
+        return err;
+    }
+    if (read == 0) {
+        return ECONNRESET;
+    }
+    m_end += read;
+    return 0;
+}
+
+std::optional<FrameView> FrameParser::next(SecureSession& session, int& err)
+{
+    err = 0;
+    const size_t available = m_end - m_start;
+    if (available < kFrameHeaderSize) {
+        return std::nullopt;
+    }
+    uint8_t* frame = m_buffer.get() + m_start;
+    if (frame[0] != kProtocolVersion) {
+        err = EPROTO;
+        return std::nullopt;
+    }
+    const size_t payload_length = ((size_t)frame[2] << 8) | frame[3];
+    if (available < payload_length + kFrameOverhead) {
+        return std::nullopt;
+    }
+    if (!session.open(frame, kFrameHeaderSize, payload_length)) {
+        err = EBADMSG;
+        return std::nullopt;
+    }
+    m_start += payload_length + kFrameOverhead;
+    return FrameView { (Channel)frame[1], frame + kFrameHeaderSize, payload_length };
+}
+
+} // namespace Intercom
@@ -0,0 +1,102 @@
+#pragma once
+#include "SecureSession.h"
+#include "TcpConnection.h"
+
+#include <atomic>
+#include <memory>
+#include <optional>
+
+namespace Intercom {
+
+// Everything on the connection after the handshake is a frame:
+//
+//     | version (1) | channel (1) | payload length (2, big endian) | encrypted payload | tag (16) |
+//
+// The header travels in the clear but is authenticated along with the payload. Audio and control
+// share the connection; control frames jump ahead of queued audio and ride along in the same
+// write as the next audio frame.
+static constexpr uint8_t kProtocolVersion = 1;
+static constexpr size_t kFrameHeaderSize = 4;
+static constexpr size_t kFrameOverhead = kFrameHeaderSize + SecureSession::kTagSize;
+static constexpr size_t kMaxFramePayload = 0xffff;
+static constexpr size_t kMaxAudioPayload = 4096; // what the sender and receiver queues are sized for
+
+enum class Channel : uint8_t {
+    Audio = 0,
+    Control = 1,
+};
+
+// First byte of every control payload; the rest is little endian.
+enum class ControlType : uint8_t {
+    Talk = 1,        // | talking (1) |
+    Keepalive = 2,   //
+    Stats = 3,       // | jitter us (4) | queuing delay us (4) |
+    AudioFormat = 4, // | sample rate (4) | channels (1) | bits per sample (1) |
+    Timestamp = 5,   // | sender's monotonic clock, us (8) |, rides along with audio
+};
+static constexpr size_t kMaxControlPayload = 24;
+
+struct AudioFormat {
+    uint32_t sample_rate;
+    uint8_t channels;
+    uint8_t bits_per_sample;
+
+    uint32_t bytes_per_second() const { return sample_rate * channels * (bits_per_sample / 8); }
+};
+
+struct ControlMessage {
+    ControlType type;
+    bool talking;
+    uint32_t jitter_us;
+    uint32_t delay_us;
+    AudioFormat format;
+    uint64_t sent_us;
+};
+
+// Returns the payload length, at most kMaxControlPayload.
+size_t encode_control(const ControlMessage& message, uint8_t* out);
+std::optional<ControlMessage> decode_control(const uint8_t* payload, size_t length);
+
+// Writes the header in front of a payload already at frame + kFrameHeaderSize, then seals it.
+// Returns the number of bytes to put on the wire.
+size_t seal_frame(SecureSession& session, Channel channel, uint8_t* frame, size_t payload_length);
+
+// Receive-side statistics, written by SessionReceiver and read by FramePacer.
+// On the wire, delay_us is the queuing delay: one-way delay from Timestamps minus the lowest seen recently.
+// Locally it holds the lowest queuing delay since the last Stats, so a standing queue shows through noise.
+struct ReceiveStats {
+    std::atomic<uint32_t> jitter_us { 0 };
+    std::atomic<uint32_t> delay_us { 0 };
+};
+
+struct LinkStats {
+    ReceiveStats local; // what we measure receiving from the peer; sent to it as Stats
+    ReceiveStats peer;  // what the peer last reported about our audio
+    std::atomic<int64_t> peer_report_us { 0 }; // steady clock time the peer's last Stats arrived
+    std::atomic<uint32_t> frames_received { 0 }; // audio frames since connect, so Stats only go out while they arrive
+};
+
+struct FrameView {
+    Channel channel;
+    uint8_t* payload;
+    size_t length;
+};
+
+// Parses frames straight out of the receive buffer: payloads are decrypted in place and handed
+// out as views, never copied.
+class FrameParser {
+    static constexpr size_t kBufferSize = 2 * (kMaxFramePayload + kFrameOverhead);
+    std::unique_ptr<uint8_t[]> m_buffer;
+    size_t m_start; // first byte of the next unparsed frame
+    size_t m_end;   // end of received data
+
+public:
+    FrameParser();
+    // Reads whatever the socket has buffered. Invalidates views returned by next().
+    // Returns EWOULDBLOCK if there was nothing, ECONNRESET if the peer hung up.
+    int fill(const TcpConnection& connection);
+    // The next complete frame, or nullopt once the buffer runs out (err = 0), the frame has an
+    // unsupported version (EPROTO) or fails authentication (EBADMSG).
+    std::optional<FrameView> next(SecureSession& session, int& err);
+};
+}
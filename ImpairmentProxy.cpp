@@ -0,0 +1,293 @@
+#include "ImpairmentProxy.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <poll.h>
+#include <stdio.h>
+#include <thread>
+
+namespace Intercom {
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr size_t kSegmentSize = 1448;       // typical Ethernet MSS
+static constexpr size_t kQueueBytes = 64 * 1024;   // bottleneck buffer before the sender feels backpressure
+static constexpr double kMinRetransmitMs = 200;    // Linux minimum RTO
+static constexpr int kIdlePollMs = 20;
+static constexpr uint64_t kReverseSeedMask = 0x5a5a5a5a5a5a5a5a;
+
+// splitmix64 finaliser; decorrelates (seed, segment, draw) into an independent uniform.
+static uint64_t mix(uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+    return x ^ (x >> 31);
+}
+
+static double uniform(uint64_t seed, uint64_t segment, uint64_t draw)
+{
+    return (double)(mix(seed ^ mix((segment * 4) + draw)) >> 11) * 0x1.0p-53;
+}
+
+static bool parse_phase(const char* text, size_t length, ImpairmentModel& model, bool& repeat)
+{
+    std::string phase(text, length);
+    size_t pos = 0;
+    while (pos < phase.size()) {
+        size_t end = phase.find(',', pos);
+        if (end == std::string::npos) {
+            end = phase.size();
+        }
+        std::string item = phase.substr(pos, end - pos);
+        pos = end + 1;
+        if (item == "repeat") {
+            repeat = true;
+            continue;
+        }
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) {
+            return false;
+        }
+        std::string key = item.substr(0, eq);
+        const char* value_str = item.c_str() + eq + 1;
+        char* value_end;
+        double value = strtod(value_str, &value_end);
+        if (value_end == value_str || *value_end != '\0' || value < 0) {
+            return false;
+        }
+        if (key == "delay") {
+            model.delay_ms = value;
+        } else if (key == "jitter") {
+            model.jitter_ms = value;
+        } else if (key == "loss" && value < 1) {
+            model.loss = value;
+        } else if (key == "burst" && value >= 1) {
+            model.burst = value;
+        } else if (key == "rate") {
+            model.rate_bps = (uint32_t)value;
+        } else if (key == "spike") {
+            model.spike_ms = value;
+        } else if (key == "spike_prob" && value <= 1) {
+            model.spike_probability = value;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::optional<ImpairmentScript> ImpairmentScript::parse(const char* script)
+{
+    ImpairmentScript result;
+    ImpairmentModel model;
+    const char* p = script;
+    while (*p != '\0') {
+        const char* end = strchr(p, ';');
+        if (end == nullptr) {
+            end = p + strlen(p);
+        }
+        char* colon;
+        double start_s = strtod(p, &colon);
+        if (colon == p || *colon != ':' || colon > end) {
+            fprintf(stderr, "ImpairmentScript - Expected '<seconds>:' in phase: %.*s\n", (int)(end - p), p);
+            return std::nullopt;
+        }
+        if (!result.m_phases.empty() && start_s <= result.m_phases.back().start_s) {
+            fprintf(stderr, "ImpairmentScript - Phases must be in increasing time order\n");
+            return std::nullopt;
+        }
+        bool repeat = false;
+        if (!parse_phase(colon + 1, end - colon - 1, model, repeat)) {
+            fprintf(stderr, "ImpairmentScript - Bad phase: %.*s\n", (int)(end - p), p);
+            return std::nullopt;
+        }
+        if (repeat) {
+            result.m_period_s = start_s;
+            break;
+        }
+        result.m_phases.push_back({ start_s, model });
+        p = *end == ';' ? end + 1 : end;
+    }
+    if (result.m_phases.empty() || result.m_phases.front().start_s != 0) {
+        result.m_phases.insert(result.m_phases.begin(), { 0, ImpairmentModel {} });
+    }
+    return result;
+}
+
+const ImpairmentModel& ImpairmentScript::at(double elapsed_s) const
+{
+    if (m_period_s > 0) {
+        elapsed_s = std::fmod(elapsed_s, m_period_s);
+    }
+    auto it = std::upper_bound(m_phases.begin(), m_phases.end(), elapsed_s,
+        [](double t, const Phase& phase) { return t < phase.start_s; });
+    return std::prev(it)->model;
+}
+
+std::optional<ImpairmentProxy> ImpairmentProxy::create(uint16_t listen_port, const char* upstream_host,
+    uint16_t upstream_port, ImpairmentScript script, uint64_t seed)
+{
+    auto listener = TcpConnectionListener::listen(listen_port);
+    if (!listener) {
+        return std::nullopt;
+    }
+    return ImpairmentProxy { std::move(*listener), upstream_host, upstream_port, std::move(script), seed };
+}
+
+namespace {
+// One direction of the relay. Reads are cut at segment boundaries so every byte of a segment gets
+// the same impairment decision regardless of how the kernel splits the stream.
+class Pump {
+    struct Segment {
+        Clock::time_point release;
+        size_t length;
+    };
+
+    const TcpConnection& m_from;
+    const TcpConnection& m_to;
+    const ImpairmentScript& m_script;
+    const uint64_t m_seed;
+    const Clock::time_point m_start;
+    std::unique_ptr<uint8_t[]> m_ring;
+    uint64_t m_head = 0; // stream offset of the oldest queued byte
+    uint64_t m_tail = 0; // stream offset of the next byte to read
+    std::deque<Segment> m_segments;
+    Clock::time_point m_link_free;
+    Clock::time_point m_last_release;
+    uint64_t m_last_segment = UINT64_MAX;
+    bool m_in_loss_burst = false;
+    bool m_segment_lost = false;
+
+    Clock::time_point release_time(Clock::time_point now, size_t length)
+    {
+        const ImpairmentModel& model = m_script.at(std::chrono::duration<double>(now - m_start).count());
+        const uint64_t segment = m_tail / kSegmentSize;
+
+        // Gilbert-Elliott loss: bursts of mean length `burst` with an overall loss rate of `loss`.
+        for (uint64_t s = m_last_segment + 1; s <= segment; s++) {
+            const double u = uniform(m_seed, s, 0);
+            if (m_in_loss_burst) {
+                m_in_loss_burst = u >= 1.0 / model.burst;
+            } else {
+                m_in_loss_burst = u < model.loss / (model.burst * (1 - model.loss));
+            }
+        }
+        if (segment != m_last_segment) {
+            m_segment_lost = m_in_loss_burst;
+            m_last_segment = segment;
+        }
+
+        double delay_ms = model.delay_ms + ((uniform(m_seed, segment, 1) * 2 - 1) * model.jitter_ms);
+        if (uniform(m_seed, segment, 2) < model.spike_probability) {
+            delay_ms += model.spike_ms;
+        }
+        if (m_segment_lost) {
+            delay_ms += kMinRetransmitMs + (2 * model.delay_ms);
+        }
+        delay_ms = std::max(0.0, delay_ms);
+
+        Clock::time_point departure = now;
+        if (model.rate_bps > 0) {
+            const std::chrono::duration<double> serialization(length * 8.0 / model.rate_bps);
+            departure = std::max(m_link_free, now) + std::chrono::duration_cast<Clock::duration>(serialization);
+            m_link_free = departure;
+        }
+        const auto release = departure + std::chrono::duration_cast<Clock::duration>(
+                                             std::chrono::duration<double, std::milli>(delay_ms));
+        // Byte stream: nothing overtakes what was read before it.
+        m_last_release = std::max(m_last_release, release);
+        return m_last_release;
+    }
+
+public:
+    Pump(const TcpConnection& from, const TcpConnection& to, const ImpairmentScript& script, uint64_t seed,
+        Clock::time_point start)
+        : m_from(from)
+        , m_to(to)
+        , m_script(script)
+        , m_seed(seed)
+        , m_start(start)
+        , m_ring(std::make_unique<uint8_t[]>(kQueueBytes))
+        , m_link_free(start)
+        , m_last_release(start)
+    {
+    }
+
+    void run(const std::atomic<bool>& running, std::atomic<bool>& done)
+    {
+        bool source_closed = false;
+        while (running && !done) {
+            auto now = Clock::now();
+            while (!m_segments.empty() && m_segments.front().release <= now) {
+                const Segment& segment = m_segments.front();
+                auto [written, err] = m_to.write(m_ring.get() + (m_head % kQueueBytes), segment.length);
+                if (err != 0) {
+                    done = true;
+                    return;
+                }
+                m_head += segment.length;
+                m_segments.pop_front();
+            }
+
+            int timeout_ms = kIdlePollMs;
+            if (!m_segments.empty()) {
+                auto wait = std::chrono::duration_cast<std::chrono::microseconds>(m_segments.front().release - now);
+                timeout_ms = std::clamp((int)((wait.count() + 999) / 1000), 0, kIdlePollMs);
+            }
+
+            const size_t free_bytes = kQueueBytes - (m_tail - m_head);
+            if (source_closed || free_bytes == 0) {
+                if (source_closed && m_segments.empty()) {
+                    break;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+                continue;
+            }
+
+            pollfd pfd { m_from.socket(), POLLIN, 0 };
+            if (::poll(&pfd, 1, timeout_ms) <= 0) {
+                continue;
+            }
+            const size_t offset = m_tail % kQueueBytes;
+            const size_t length = std::min({ free_bytes, kQueueBytes - offset, kSegmentSize - (m_tail % kSegmentSize) });
+            auto [read, err] = m_from.read_once(m_ring.get() + offset, length);
+            if (err != 0 || read == 0) {
+                source_closed = true;
+                continue;
+            }
+            now = Clock::now();
+            m_segments.push_back({ release_time(now, read), read });
+            m_tail += read;
+        }
+        done = true;
+    }
+};
+}
+
+bool ImpairmentProxy::relay(const std::atomic<bool>& running)
+{
+    auto client = m_listener.accept();
+    if (!client) {
+        return false;
+    }
+    auto upstream = TcpConnection::connect(m_upstream_host.c_str(), m_upstream_port);
+    if (!upstream) {
+        return false;
+    }
+
+    const auto start = Clock::now();
+    std::atomic<bool> done = false;
+    Pump forward(*client, *upstream, m_script, m_seed, start);
+    Pump reverse(*upstream, *client, m_script, m_seed ^ kReverseSeedMask, start);
+    std::thread reverse_thread([&] { reverse.run(running, done); });
+    forward.run(running, done);
+    reverse_thread.join();
+    return true;
+}
+
+} // namespace Intercom
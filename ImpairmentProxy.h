@@ -0,0 +1,77 @@
+#pragma once
+#include "TcpConnection.h"
+
+#include <atomic>
+#include <chrono>
+#include <optional>
+#include <vector>
+
+namespace Intercom {
+
+struct ImpairmentModel {
+    double delay_ms = 0;          // fixed one-way delay
+    double jitter_ms = 0;         // uniform +/- around the delay
+    double loss = 0;              // average fraction of segments lost
+    double burst = 1;             // mean length of a loss burst, in segments
+    uint32_t rate_bps = 0;        // bottleneck bandwidth, 0 for unlimited
+    double spike_ms = 0;          // extra delay added by a latency spike
+    double spike_probability = 0; // chance a segment hits a spike
+};
+
+// Network conditions over time, written as phases that each start at an offset in seconds and
+// override some of the previous phase's values:
+//
+//     "0:delay=20,jitter=5;30:loss=0.05,burst=4;60:rate=256000,spike=300,spike_prob=0.01;90:repeat"
+//
+// A final "repeat" phase loops the script with that period; otherwise the last phase holds.
+class ImpairmentScript {
+    struct Phase {
+        double start_s;
+        ImpairmentModel model;
+    };
+    std::vector<Phase> m_phases;
+    double m_period_s = 0;
+
+public:
+    static std::optional<ImpairmentScript> parse(const char* script);
+    const ImpairmentModel& at(double elapsed_s) const;
+};
+
+// Loopback TCP proxy that applies an ImpairmentScript to everything it relays. TCP never loses
+// bytes, so a lost segment shows up the way it does on a real link: it is held back for a
+// retransmission timeout and delays everything behind it. The relay buffers at most a router's
+// worth of data so a bandwidth cap pushes back on the sender instead of queueing forever.
+// Impairment decisions are drawn from the seed and each segment's offset in the byte stream,
+// so the same seed and traffic reproduce the same loss and delay pattern.
+//
+// The proxy terminates TCP, so the sender's own connection is a clean loopback hop: TCP_INFO
+// shows near-zero RTT and no retransmits whatever the script says. Impairment only reaches the
+// sender as back-pressure (time blocked on a full send buffer) and as what the receiver reports
+// over the control channel. Testing the TCP_INFO loss and RTT inputs needs impairment below
+// TCP, e.g. netem in a network namespace.
+class ImpairmentProxy {
+    TcpConnectionListener m_listener;
+    std::string m_upstream_host;
+    uint16_t m_upstream_port;
+    ImpairmentScript m_script;
+    uint64_t m_seed;
+
+    ImpairmentProxy(TcpConnectionListener listener, const char* upstream_host, uint16_t upstream_port,
+        ImpairmentScript script, uint64_t seed)
+        : m_listener(std::move(listener))
+        , m_upstream_host(upstream_host)
+        , m_upstream_port(upstream_port)
+        , m_script(std::move(script))
+        , m_seed(seed)
+    {
+    }
+
+public:
+    static std::optional<ImpairmentProxy> create(uint16_t listen_port, const char* upstream_host,
+        uint16_t upstream_port, ImpairmentScript script, uint64_t seed);
+
+    // Accepts one client, connects it upstream and relays both directions until either side
+    // closes or running is cleared. Blocks the calling thread.
+    bool relay(const std::atomic<bool>& running);
+};
+}
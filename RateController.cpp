@@ -0,0 +1,48 @@
+#include "RateController.h"
+
+#include <algorithm>
+
+namespace Intercom {
+
+static constexpr double kHeavyLossFraction = 0.10;
+static constexpr double kLightLossFraction = 0.02;
+static constexpr double kOveruseGradientMs = 5.0;
+static constexpr double kDecreaseFactor = 0.85;
+static constexpr double kIncreaseFactor = 1.08;
+
+RateController::RateController(uint32_t min_bitrate, uint32_t max_bitrate, double latency_target_ms)
+    : m_bitrate(max_bitrate)
+    , m_min_bitrate(min_bitrate)
+    , m_max_bitrate(max_bitrate)
+    , m_latency_target_ms(latency_target_ms)
+    , m_last_rtt_ms(0)
+    , m_last_queuing_delay_ms(0)
+{
+}
+
+void RateController::on_feedback(const FeedbackReport& report)
+{
+    m_last_rtt_ms = report.rtt_ms;
+    m_last_queuing_delay_ms = report.queuing_delay_ms;
+    // One-way delay plus a couple of jitter deviations is what the listener actually experiences.
+    // The RTT misses data queued ahead of the sender's TCP, which only the receiver can see.
+    const double expected_delay_ms = (report.rtt_ms / 2) + report.queuing_delay_ms + (2 * report.jitter_ms);
+    // A rise within the jitter is noise; a slow real one still shows up in expected_delay_ms.
+    const double overuse_gradient_ms = std::max(kOveruseGradientMs, report.jitter_ms);
+
+    if (report.loss_fraction > kHeavyLossFraction) {
+        m_bitrate *= 1.0 - (0.5 * report.loss_fraction);
+    } else if (report.delay_gradient_ms > overuse_gradient_ms || expected_delay_ms > m_latency_target_ms) {
+        m_bitrate *= kDecreaseFactor;
+    } else if (report.loss_fraction < kLightLossFraction && report.delay_gradient_ms <= 0) {
+        m_bitrate *= kIncreaseFactor;
+    }
+    m_bitrate = std::clamp(m_bitrate, m_min_bitrate, m_max_bitrate);
+}
+
+double RateController::queue_budget_ms() const
+{
+    return std::max(0.0, m_latency_target_ms - (m_last_rtt_ms / 2) - m_last_queuing_delay_ms);
+}
+
+} // namespace Intercom
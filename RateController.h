@@ -0,0 +1,33 @@
+#pragma once
+#include <cstdint>
+
+namespace Intercom {
+
+// Congestion signals for one reporting interval.
+struct FeedbackReport {
+    double loss_fraction;     // 0.0 - 1.0, share of segments that had to be retransmitted
+    double jitter_ms;         // variation in round-trip time or, when the receiver reports it, arrival time
+    double delay_gradient_ms; // change in end-to-end queuing delay since the previous report
+    double rtt_ms;
+    double queuing_delay_ms;  // one-way queuing the receiver measured, 0 without a recent report
+};
+
+// Picks the send bitrate from feedback reports: back off multiplicatively on loss or growing delay,
+// probe upwards slowly while the path is clear.
+class RateController {
+    double m_bitrate;
+    double m_min_bitrate;
+    double m_max_bitrate;
+    double m_latency_target_ms;
+    double m_last_rtt_ms;
+    double m_last_queuing_delay_ms;
+
+public:
+    RateController(uint32_t min_bitrate, uint32_t max_bitrate, double latency_target_ms);
+    void on_feedback(const FeedbackReport& report);
+    uint32_t target_bitrate() const { return (uint32_t)m_bitrate; }
+    double latency_target_ms() const { return m_latency_target_ms; }
+    // Time a frame can spend queued locally before it can no longer arrive within the latency target.
+    double queue_budget_ms() const;
+};
+}
@@ -0,0 +1,223 @@
+#include "SecureSession.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <stdio.h>
+#include <sys/random.h>
+
+namespace Intercom {
+
+static constexpr size_t kSaltSize = 16;
+static constexpr int kHandshakeTimeoutMs = 5000;
+static constexpr uint32_t kDataContext = 0;
+static constexpr uint32_t kConfirmContext = 1;
+static constexpr uint8_t kInitiatorLabel[16] = { 'i', 'n', 't', 'e', 'r', 'c', 'o', 'm', ' ', 'i', '>', 'r' };
+static constexpr uint8_t kResponderLabel[16] = { 'i', 'n', 't', 'e', 'r', 'c', 'o', 'm', ' ', 'r', '>', 'i' };
+static constexpr uint8_t kDiscoveryLabel[16] = { 'i', 'n', 't', 'e', 'r', 'c', 'o', 'm', ' ', 'h', 'e', 'l', 'l', 'o' };
+
+// | context (4 bytes) | sequence number (8 bytes) |, both little endian.
+static void make_nonce(uint32_t context, uint64_t sequence, uint8_t nonce[ChaCha20Poly1305::kNonceSize])
+{
+    for (int i = 0; i < 4; i++) {
+        nonce[i] = (uint8_t)(context >> (8 * i));
+    }
+    for (int i = 0; i < 8; i++) {
+        nonce[4 + i] = (uint8_t)(sequence >> (8 * i));
+    }
+}
+
+static int hex_value(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+std::optional<SessionKey> parse_session_key(const char* hex)
+{
+    if (strlen(hex) != 2 * ChaCha20Poly1305::kKeySize) {
+        return std::nullopt;
+    }
+    SessionKey key;
+    for (size_t i = 0; i < key.size(); i++) {
+        int hi = hex_value(hex[2 * i]);
+        int lo = hex_value(hex[(2 * i) + 1]);
+        if (hi < 0 || lo < 0) {
+            return std::nullopt;
+        }
+        key[i] = (uint8_t)((hi << 4) | lo);
+    }
+    return key;
+}
+
+std::optional<SecureSession> SecureSession::handshake(const TcpConnection& connection, const SessionKey& key, bool initiator)
+{
+    // A peer that stalls mid-handshake mustn't hold us forever.
+    if (!connection.set_receive_timeout(kHandshakeTimeoutMs)) {
+        fprintf(stderr, "SecureSession - Failed to set handshake timeout: %s\n", strerror(errno));
+        return std::nullopt;
+    }
+    auto session = exchange_keys(connection, key, initiator);
+    connection.set_receive_timeout(0);
+    return session;
+}
+
+std::optional<SecureSession> SecureSession::exchange_keys(
+    const TcpConnection& connection, const SessionKey& key, bool initiator)
+{
+    uint8_t local_salt[kSaltSize];
+    if (getentropy(local_salt, sizeof(local_salt)) != 0) {
+        fprintf(stderr, "SecureSession - Failed to generate salt: %s\n", strerror(errno));
+        return std::nullopt;
+    }
+    uint8_t peer_salt[kSaltSize];
+    if (auto [written, err] = connection.write(local_salt, sizeof(local_salt)); err != 0) {
+        fprintf(stderr, "SecureSession - Failed to send salt: %s\n", strerror(err));
+        return std::nullopt;
+    }
+    if (auto [read, err] = connection.read(peer_salt, sizeof(peer_salt)); err != 0) {
+        fprintf(stderr, "SecureSession - Failed to receive salt: %s\n",
+            err == EWOULDBLOCK ? "timed out" : strerror(err));
+        return std::nullopt;
+    }
+
+    // transcript = initiator salt || responder salt
+    uint8_t transcript[2 * kSaltSize];
+    memcpy(transcript, initiator ? local_salt : peer_salt, kSaltSize);
+    memcpy(transcript + kSaltSize, initiator ? peer_salt : local_salt, kSaltSize);
+
+    uint8_t stage[ChaCha20Poly1305::kKeySize];
+    uint8_t master[ChaCha20Poly1305::kKeySize];
+    uint8_t initiator_key[ChaCha20Poly1305::kKeySize];
+    uint8_t responder_key[ChaCha20Poly1305::kKeySize];
+    hchacha20(key.data(), transcript + kSaltSize, stage);
+    hchacha20(stage, transcript, master);
+    hchacha20(master, kInitiatorLabel, initiator_key);
+    hchacha20(master, kResponderLabel, responder_key);
+    SecureSession session(initiator ? initiator_key : responder_key, initiator ? responder_key : initiator_key);
+    secure_zero(stage, sizeof(stage));
+    secure_zero(master, sizeof(master));
+    secure_zero(initiator_key, sizeof(initiator_key));
+    secure_zero(responder_key, sizeof(responder_key));
+
+    // Key confirmation: a tag over the transcript that only a holder of the pre-shared key can produce.
+    uint8_t nonce[ChaCha20Poly1305::kNonceSize];
+    make_nonce(kConfirmContext, 0, nonce);
+    uint8_t confirm[ChaCha20Poly1305::kTagSize];
+    session.m_tx.seal(nonce, transcript, sizeof(transcript), nullptr, 0, confirm);
+    if (auto [written, err] = connection.write(confirm, sizeof(confirm)); err != 0) {
+        fprintf(stderr, "SecureSession - Failed to send key confirmation: %s\n", strerror(err));
+        return std::nullopt;
+    }
+    uint8_t peer_confirm[ChaCha20Poly1305::kTagSize];
+    if (auto [read, err] = connection.read(peer_confirm, sizeof(peer_confirm)); err != 0) {
+        fprintf(stderr, "SecureSession - Failed to receive key confirmation: %s\n",
+            err == EWOULDBLOCK ? "timed out" : strerror(err));
+        return std::nullopt;
+    }
+    if (!session.m_rx.open(nonce, transcript, sizeof(transcript), nullptr, 0, peer_confirm)) {
+        fprintf(stderr, "SecureSession - Peer does not have the same key\n");
+        return std::nullopt;
+    }
+    return session;
+}
+
+void SecureSession::seal(uint8_t* frame, size_t header_size, size_t payload_length)
+{
+    uint8_t nonce[ChaCha20Poly1305::kNonceSize];
+    make_nonce(kDataContext, m_tx_sequence++, nonce);
+    uint8_t* payload = frame + header_size;
+    m_tx.seal(nonce, frame, header_size, payload, payload_length, payload + payload_length);
+}
+
+bool SecureSession::open(uint8_t* frame, size_t header_size, size_t payload_length)
+{
+    uint8_t nonce[ChaCha20Poly1305::kNonceSize];
+    make_nonce(kDataContext, m_rx_sequence, nonce);
+    uint8_t* payload = frame + header_size;
+    if (!m_rx.open(nonce, frame, header_size, payload, payload_length, payload + payload_length)) {
+        return false;
+    }
+    m_rx_sequence++;
+    return true;
+}
+
+static int64_t unix_time_ms()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static ChaCha20Poly1305 discovery_aead(const SessionKey& key)
+{
+    uint8_t discovery_key[ChaCha20Poly1305::kKeySize];
+    hchacha20(key.data(), kDiscoveryLabel, discovery_key);
+    ChaCha20Poly1305 aead(discovery_key);
+    secure_zero(discovery_key, sizeof(discovery_key));
+    return aead;
+}
+
+size_t sign_discovery(const SessionKey& key, uint8_t* message, size_t length, size_t capacity)
+{
+    if (capacity < length + kDiscoveryOverhead) {
+        return 0;
+    }
+    const uint64_t timestamp = (uint64_t)unix_time_ms();
+    for (int i = 0; i < 8; i++) {
+        message[length + i] = (uint8_t)(timestamp >> (8 * i));
+    }
+    uint8_t* nonce = message + length + 8;
+    if (getentropy(nonce, ChaCha20Poly1305::kNonceSize) != 0) {
+        return 0;
+    }
+    // The timestamp is authenticated along with the message.
+    discovery_aead(key).seal(nonce, message, length + 8, nullptr, 0, nonce + ChaCha20Poly1305::kNonceSize);
+    return length + kDiscoveryOverhead;
+}
+
+DiscoveryVerifier::DiscoveryVerifier(const SessionKey& key)
+    : m_aead(discovery_aead(key))
+    , m_seen {}
+    , m_seen_next(0)
+{
+}
+
+size_t DiscoveryVerifier::verify(const uint8_t* packet, size_t length)
+{
+    if (length < kDiscoveryOverhead) {
+        return 0;
+    }
+    const size_t message_length = length - kDiscoveryOverhead;
+    const uint8_t* nonce = packet + message_length + 8;
+    if (!m_aead.open(nonce, packet, message_length + 8, nullptr, 0, nonce + ChaCha20Poly1305::kNonceSize)) {
+        return 0;
+    }
+
+    uint64_t timestamp = 0;
+    for (int i = 0; i < 8; i++) {
+        timestamp |= (uint64_t)packet[message_length + i] << (8 * i);
+    }
+    const int64_t age_ms = unix_time_ms() - (int64_t)timestamp;
+    if (age_ms > kMaxClockSkewMs || age_ms < -kMaxClockSkewMs) {
+        return 0;
+    }
+    // A replay within the window carries a nonce we've already accepted.
+    for (const auto& seen : m_seen) {
+        if (memcmp(seen.data(), nonce, seen.size()) == 0) {
+            return 0;
+        }
+    }
+    memcpy(m_seen[m_seen_next].data(), nonce, ChaCha20Poly1305::kNonceSize);
+    m_seen_next = (m_seen_next + 1) % kReplayCacheSize;
+    return message_length;
+}
+
+} // namespace Intercom
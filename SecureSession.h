@@ -0,0 +1,79 @@
+#pragma once
+#include "ChaCha20Poly1305.h"
+#include "TcpConnection.h"
+
+#include <array>
+#include <optional>
+
+namespace Intercom {
+
+using SessionKey = std::array<uint8_t, ChaCha20Poly1305::kKeySize>;
+
+// Parses the 64 hex digit pre-shared key both peers are configured with.
+std::optional<SessionKey> parse_session_key(const char* hex);
+
+// Encryption for the frames of one connection. Both peers prove knowledge of the pre-shared key
+// during the handshake and derive fresh per-direction keys from exchanged salts. Nonces come from
+// per-direction sequence numbers, so frames must be opened in the order they were sealed and a
+// dropped, replayed or reordered frame fails authentication.
+class SecureSession {
+public:
+    static constexpr size_t kTagSize = ChaCha20Poly1305::kTagSize;
+
+private:
+    ChaCha20Poly1305 m_tx;
+    ChaCha20Poly1305 m_rx;
+    uint64_t m_tx_sequence;
+    uint64_t m_rx_sequence;
+
+    SecureSession(const uint8_t tx_key[ChaCha20Poly1305::kKeySize], const uint8_t rx_key[ChaCha20Poly1305::kKeySize])
+        : m_tx(tx_key)
+        , m_rx(rx_key)
+        , m_tx_sequence(0)
+        , m_rx_sequence(0)
+    {
+    }
+
+    static std::optional<SecureSession> exchange_keys(
+        const TcpConnection& connection, const SessionKey& key, bool initiator);
+
+public:
+    // Must run on a blocking connection before any media flows. The listening side passes
+    // initiator = false. Fails if the peer hangs up or goes quiet for a few seconds.
+    static std::optional<SecureSession> handshake(const TcpConnection& connection, const SessionKey& key, bool initiator);
+
+    // frame is header_size bytes of header, authenticated but sent in the clear, followed by the
+    // payload and kTagSize bytes of room for the tag. The payload is encrypted in place.
+    void seal(uint8_t* frame, size_t header_size, size_t payload_length);
+    // Verifies and decrypts a frame laid out as above in place.
+    bool open(uint8_t* frame, size_t header_size, size_t payload_length);
+};
+
+// Discovery broadcasts carry a signed timestamp so other hosts on the segment can neither inject
+// them nor replay captured ones later:
+//
+//     | message | timestamp (8, unix ms) | nonce (12) | tag (16) |
+//
+// Appends kDiscoveryOverhead bytes to message; capacity must allow for them.
+static constexpr size_t kDiscoveryOverhead = 8 + ChaCha20Poly1305::kNonceSize + ChaCha20Poly1305::kTagSize;
+size_t sign_discovery(const SessionKey& key, uint8_t* message, size_t length, size_t capacity);
+
+// Accepts a broadcast once, and only within kMaxClockSkewMs of our clock.
+class DiscoveryVerifier {
+public:
+    static constexpr int64_t kMaxClockSkewMs = 30000;
+
+private:
+    // Enough for a couple of hosts broadcasting every second for the whole acceptance window.
+    static constexpr size_t kReplayCacheSize = 256;
+    ChaCha20Poly1305 m_aead;
+    std::array<std::array<uint8_t, ChaCha20Poly1305::kNonceSize>, kReplayCacheSize> m_seen;
+    size_t m_seen_next;
+
+public:
+    explicit DiscoveryVerifier(const SessionKey& key);
+    // Returns the length of the authenticated message, or 0 if the tag doesn't verify, the
+    // timestamp is stale or the packet has been seen before.
+    size_t verify(const uint8_t* packet, size_t length);
+};
+}
@@ -0,0 +1,226 @@
+#include "SessionReceiver.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <stdio.h>
+
+namespace Intercom {
+
+static constexpr int kPollTimeoutMs = 100;
+static constexpr auto kPeerTimeout = std::chrono::seconds(5);
+// Short enough that drift between the two clocks stays well under a millisecond.
+static constexpr auto kMinDelayWindow = std::chrono::seconds(15);
+
+SessionReceiver::SessionReceiver(const TcpConnection& connection, SecureSession& session, LinkStats& stats,
+    AudioFormat format, double latency_target_ms)
+    : m_connection(connection)
+    , m_session(session)
+    , m_stats(stats)
+    , m_format(format)
+    , m_max_queued_bytes((size_t)(format.bytes_per_second() * latency_target_ms / 1000))
+    , m_queue(std::make_unique<AudioSlot[]>(kQueueDepth))
+    , m_head(0)
+    , m_tail(0)
+    , m_queued_bytes(0)
+    , m_read_offset(0)
+    , m_running(false)
+    , m_connected(true)
+    , m_error(0)
+    , m_jitter_us(0)
+    , m_last_offset_us(0)
+    , m_have_offset(false)
+    , m_min_offset_us(INT64_MAX)
+    , m_last_min_offset_us(INT64_MAX)
+    , m_timeout_reported(false)
+    , m_peer_talking(false)
+{
+}
+
+SessionReceiver::~SessionReceiver()
+{
+    stop();
+}
+
+void SessionReceiver::start()
+{
+    if (m_running.exchange(true)) {
+        return;
+    }
+    m_thread = std::thread([this] { run(); });
+}
+
+void SessionReceiver::stop()
+{
+    m_running = false;
+    if (m_thread.joinable()) {
+        m_thread.join();
+    }
+}
+
+void SessionReceiver::run()
+{
+    m_last_frame = Clock::now();
+    while (m_running) {
+        pollfd pfd { m_connection.socket(), POLLIN, 0 };
+        const int ready = ::poll(&pfd, 1, kPollTimeoutMs);
+        const auto now = Clock::now();
+        if (ready > 0) {
+            int err = m_parser.fill(m_connection);
+            if (err == ECONNRESET) {
+                printf("SessionReceiver - Peer closed the connection\n");
+                m_error = err;
+                break;
+            }
+            if (err != 0 && err != EWOULDBLOCK && err != EINTR) {
+                fprintf(stderr, "SessionReceiver - Failed to read: %s\n", strerror(err));
+                m_error = err;
+                break;
+            }
+            while (auto frame = m_parser.next(m_session, err)) {
+                m_last_frame = now;
+                m_timeout_reported = false;
+                if (frame->channel == Channel::Audio) {
+                    handle_audio(*frame);
+                } else if (frame->channel == Channel::Control) {
+                    handle_control(*frame);
+                } // Channels from a newer peer are authenticated but ignored
+            }
+            if (err != 0) {
+                fprintf(stderr, "SessionReceiver - Dropping connection: %s\n",
+                    err == EPROTO ? "unsupported protocol version" : "frame failed authentication");
+                m_error = err;
+                break;
+            }
+        }
+        if (!m_timeout_reported && now - m_last_frame > kPeerTimeout) {
+            printf("SessionReceiver - Nothing from peer for %lld seconds\n", (long long)kPeerTimeout.count());
+            m_timeout_reported = true;
+        }
+    }
+    m_connected = false;
+}
+
+void SessionReceiver::handle_audio(const FrameView& frame)
+{
+    if (frame.length > kMaxAudioPayload) {
+        return;
+    }
+    m_stats.frames_received.fetch_add(1, std::memory_order_relaxed);
+
+    const uint64_t tail = m_tail.load(std::memory_order_relaxed);
+    if (tail - m_head.load(std::memory_order_acquire) >= kQueueDepth) {
+        return; // Playback is stopped or stalled
+    }
+    AudioSlot& slot = m_queue[tail % kQueueDepth];
+    slot.length = frame.length;
+    memcpy(slot.data, frame.payload, frame.length);
+    m_queued_bytes.fetch_add(frame.length, std::memory_order_relaxed);
+    m_tail.store(tail + 1, std::memory_order_release);
+}
+
+void SessionReceiver::handle_control(const FrameView& frame)
+{
+    auto message = decode_control(frame.payload, frame.length);
+    if (!message) {
+        return;
+    }
+    switch (message->type) {
+    case ControlType::Talk:
+        if (m_peer_talking != message->talking) {
+            m_peer_talking = message->talking;
+            printf("SessionReceiver - Peer %s talking\n", message->talking ? "started" : "stopped");
+        }
+        if (!message->talking) {
+            // The pause isn't jitter, and what we measured before it no longer describes the path.
+            m_have_offset = false;
+            m_jitter_us = 0;
+            m_stats.local.jitter_us.store(0, std::memory_order_relaxed);
+        }
+        break;
+    case ControlType::Keepalive:
+        break;
+    case ControlType::Stats:
+        m_stats.peer.jitter_us.store(message->jitter_us, std::memory_order_relaxed);
+        m_stats.peer.delay_us.store(message->delay_us, std::memory_order_relaxed);
+        m_stats.peer_report_us.store(
+            std::chrono::duration_cast<std::chrono::microseconds>(Clock::now().time_since_epoch()).count(),
+            std::memory_order_release);
+        break;
+    case ControlType::AudioFormat:
+        if (message->format.sample_rate != m_format.sample_rate || message->format.channels != m_format.channels
+            || message->format.bits_per_sample != m_format.bits_per_sample) {
+            fprintf(stderr, "SessionReceiver - Peer sends %u Hz, %u channel, %u bit audio; expected %u Hz, %u, %u\n",
+                message->format.sample_rate, message->format.channels, message->format.bits_per_sample,
+                m_format.sample_rate, m_format.channels, m_format.bits_per_sample);
+        }
+        break;
+    case ControlType::Timestamp:
+        handle_timestamp(message->sent_us);
+        break;
+    }
+}
+
+void SessionReceiver::handle_timestamp(uint64_t sent_us)
+{
+    // The clocks aren't synchronised, so this is the one-way delay plus an unknown offset. The
+    // lowest value seen over the last window or two stands in for the offset plus the path's base
+    // delay; what's left above it is queuing.
+    const auto now = Clock::now();
+    const int64_t now_us = std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count();
+    const int64_t offset_us = now_us - (int64_t)sent_us;
+
+    // RFC 3550 interarrival jitter: the change in transit time, so frames the sender dropped
+    // don't count as late.
+    if (m_have_offset) {
+        m_jitter_us += ((double)std::abs(offset_us - m_last_offset_us) - m_jitter_us) / 16;
+        m_stats.local.jitter_us.store((uint32_t)m_jitter_us, std::memory_order_relaxed);
+    }
+    m_last_offset_us = offset_us;
+    m_have_offset = true;
+
+    if (now - m_min_window_start >= kMinDelayWindow) {
+        m_last_min_offset_us = m_min_offset_us;
+        m_min_offset_us = offset_us;
+        m_min_window_start = now;
+    }
+    m_min_offset_us = std::min(m_min_offset_us, offset_us);
+    const auto queuing_us = (uint32_t)std::min<int64_t>(
+        offset_us - std::min(m_min_offset_us, m_last_min_offset_us), UINT32_MAX - 1);
+    uint32_t lowest = m_stats.local.delay_us.load(std::memory_order_relaxed);
+    while (queuing_us < lowest
+        && !m_stats.local.delay_us.compare_exchange_weak(lowest, queuing_us, std::memory_order_relaxed)) {
+    }
+}
+
+size_t SessionReceiver::read_audio(uint8_t* out, size_t length)
+{
+    size_t copied = 0;
+    uint64_t head = m_head.load(std::memory_order_relaxed);
+    while (copied < length) {
+        const uint64_t tail = m_tail.load(std::memory_order_acquire);
+        if (head == tail) {
+            break;
+        }
+        AudioSlot& slot = m_queue[head % kQueueDepth];
+        // Between frames, skip whole ones until we're back within the latency target.
+        const bool behind = m_queued_bytes.load(std::memory_order_relaxed) > m_max_queued_bytes;
+        const bool skip = m_read_offset == 0 && tail - head > 1 && behind;
+        if (!skip) {
+            const size_t n = std::min(length - copied, slot.length - m_read_offset);
+            memcpy(out + copied, slot.data + m_read_offset, n);
+            m_read_offset += n;
+            copied += n;
+        }
+        if (skip || m_read_offset == slot.length) {
+            m_queued_bytes.fetch_sub(slot.length, std::memory_order_relaxed);
+            m_read_offset = 0;
+            m_head.store(++head, std::memory_order_release);
+        }
+    }
+    return copied;
+}
+
+} // namespace Intercom
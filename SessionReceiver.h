@@ -0,0 +1,72 @@
+#pragma once
+#include "FrameProtocol.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+
+namespace Intercom {
+
+// Drains the connection on its own thread so control frames are handled even while the playback
+// stream is stopped. Audio frames go into a lock-free queue that the playback callback reads with
+// read_audio(). If more than the latency target is queued, whole frames are skipped to catch up.
+// Timestamps from the sender give the one-way queuing delay it gets back in our Stats.
+class SessionReceiver {
+    static constexpr size_t kQueueDepth = 64;
+    using Clock = std::chrono::steady_clock;
+    struct AudioSlot {
+        size_t length;
+        uint8_t data[kMaxAudioPayload];
+    };
+
+    const TcpConnection& m_connection;
+    SecureSession& m_session;
+    LinkStats& m_stats;
+    const AudioFormat m_format;
+    const size_t m_max_queued_bytes;
+    std::unique_ptr<AudioSlot[]> m_queue;
+    std::atomic<uint64_t> m_head; // owned by the playback callback
+    std::atomic<uint64_t> m_tail; // owned by the receive thread
+    std::atomic<size_t> m_queued_bytes;
+    size_t m_read_offset; // into the head slot
+    std::atomic<bool> m_running;
+    std::atomic<bool> m_connected;
+    std::atomic<int> m_error;
+    std::thread m_thread;
+
+    // Receive thread state
+    FrameParser m_parser;
+    Clock::time_point m_last_frame;
+    double m_jitter_us;
+    int64_t m_last_offset_us; // receive time minus send time of the previous Timestamp
+    bool m_have_offset;
+    int64_t m_min_offset_us;      // lowest receive time minus send time in the current window
+    int64_t m_last_min_offset_us; // and in the previous one
+    Clock::time_point m_min_window_start;
+    bool m_timeout_reported;
+    bool m_peer_talking;
+
+    void run();
+    void handle_audio(const FrameView& frame);
+    void handle_control(const FrameView& frame);
+    void handle_timestamp(uint64_t sent_us);
+
+public:
+    SessionReceiver(const TcpConnection& connection, SecureSession& session, LinkStats& stats, AudioFormat format,
+        double latency_target_ms);
+    ~SessionReceiver();
+    SessionReceiver(const SessionReceiver&) = delete;
+    SessionReceiver& operator=(const SessionReceiver&) = delete;
+
+    void start();
+    void stop();
+    // Safe to call from the real-time audio callback. Returns the number of bytes copied;
+    // the caller fills the rest with silence.
+    size_t read_audio(uint8_t* out, size_t length);
+    bool connected() const { return m_connected; }
+    // Why the receive thread stopped: ECONNRESET if the peer hung up, EPROTO or EBADMSG for a
+    // frame we couldn't accept, another errno if the read failed. 0 while connected or after stop().
+    int last_error() const { return m_error; }
+};
+}
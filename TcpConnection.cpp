@@ -2,15 +2,35 @@
 
 #include <arpa/inet.h>
 #include <cerrno>
+#include <climits>
+#include <cstring>
 #include <fcntl.h>
 #include <netdb.h>
 #include <netinet/tcp.h> // for TCP_NODELAY
 #include <stdio.h>
+#include <sys/socket.h>
 #include <unistd.h>
 #include <string>
 
 namespace Intercom {
 
+// Writing to a connection the peer has closed must fail with EPIPE, not kill the process.
+#if defined(MSG_NOSIGNAL)
+static constexpr int kSendFlags = MSG_NOSIGNAL;
+#else
+static constexpr int kSendFlags = 0;
+#endif
+
+static void DisableSigPipe(int sockfd)
+{
+#if defined(SO_NOSIGPIPE)
+    int flag = 1;
+    setsockopt(sockfd, SOL_SOCKET, SO_NOSIGPIPE, &flag, sizeof(flag));
+#else
+    (void)sockfd;
+#endif
+}
+
 static bool DnsResolve(const char* host, sockaddr_in* addr_out)
 {
     addrinfo* result;
@@ -62,7 +82,8 @@ std::pair<uint64_t, int> TcpConnection::read_once(uint8_t* buffer, size_t len) c
         return { ret, 0 };
     }
 
-    return { 0, EWOULDBLOCK };
+    // EWOULDBLOCK when there's nothing to read, anything else is a real socket error.
+    return { 0, errno };
 }
 
 std::pair<uint64_t, int> TcpConnection::read(uint8_t* buffer, size_t len) const
@@ -74,7 +95,10 @@ std::pair<uint64_t, int> TcpConnection::read(uint8_t* buffer, size_t len) const
     while (bytes_read < len) {
         int64_t ret = ::read(m_sockfd, buffer + bytes_read, len - bytes_read);
         if (ret < 0) {
-            return { ret, errno };
+            return { bytes_read, errno };
+        }
+        if (ret == 0) {
+            return { bytes_read, ECONNRESET }; // Peer closed before sending everything
         }
         bytes_read += (uint64_t)ret; // should be safe to cast to uint64_t. It's always positive.
     }
@@ -88,9 +112,10 @@ std::pair<uint64_t, int> TcpConnection::write(const uint8_t* buffer, size_t leng
     }
     uint64_t bytes_written = 0;
     while (bytes_written < length) {
-        int64_t ret = ::write(m_sockfd, buffer + bytes_written, length - bytes_written);
+        int64_t ret = ::send(m_sockfd, buffer + bytes_written, length - bytes_written, kSendFlags);
         if (ret < 0) {
-            return { ret, errno };
+            // Report what made it out so callers on non-blocking sockets can resume from there.
+            return { bytes_written, errno };
         }
         bytes_written += (uint64_t)ret; // should be safe to cast to uint64_t. It's always positive.
     }
@@ -104,6 +129,47 @@ bool TcpConnection::set_non_blocking()
     return ret == 0;
 }
 
+bool TcpConnection::set_unsent_limit(int bytes) const
+{
+#if defined(TCP_NOTSENT_LOWAT)
+    return setsockopt(m_sockfd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &bytes, sizeof(bytes)) == 0;
+#else
+    (void)bytes;
+    return false;
+#endif
+}
+
+bool TcpConnection::set_receive_timeout(int timeout_ms) const
+{
+    timeval timeout {};
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_usec = (timeout_ms % 1000) * 1000;
+    return setsockopt(m_sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) == 0;
+}
+
+std::optional<TcpTransportInfo> TcpConnection::transport_info() const
+{
+#if defined(__linux__)
+    tcp_info info {};
+    socklen_t len = sizeof(info);
+    if (getsockopt(m_sockfd, IPPROTO_TCP, TCP_INFO, &info, &len) < 0) {
+        return std::nullopt;
+    }
+    return TcpTransportInfo { info.tcpi_rtt, info.tcpi_rttvar, info.tcpi_total_retrans, info.tcpi_snd_mss };
+#elif defined(__APPLE__)
+    tcp_connection_info info {};
+    socklen_t len = sizeof(info);
+    if (getsockopt(m_sockfd, IPPROTO_TCP, TCP_CONNECTION_INFO, &info, &len) < 0) {
+        return std::nullopt;
+    }
+    // macOS reports smoothed RTT in milliseconds.
+    return TcpTransportInfo { info.tcpi_srtt * 1000, info.tcpi_rttvar * 1000,
+        (uint32_t)info.tcpi_txretransmitpackets, info.tcpi_maxseg };
+#else
+    return std::nullopt;
+#endif
+}
+
 std::optional<TcpConnection> TcpConnection::connect(const char* hostname, uint16_t port)
 {
     struct sockaddr_in addr;
@@ -131,6 +197,7 @@ std::optional<TcpConnection> TcpConnection::connect(const char* hostname, uint16
     }
 
     addr.sin_port = htons(port);
+    DisableSigPipe(sockfd);
 
     if (::connect(sockfd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
         fprintf(stderr, "TcpConnection - Failed to connect: %s", strerror(errno));
@@ -216,6 +283,7 @@ std::optional<TcpConnection> TcpConnectionListener::accept()
         fprintf(stderr, "TcpConnection - Failed to set TCP_NODELAY: %s", strerror(errno));
         return std::nullopt;
     }
+    DisableSigPipe(client_socket);
 
     printf("TcpConnectionListener - Accepted connection");
     return TcpConnection { client_socket };
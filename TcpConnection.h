@@ -1,7 +1,18 @@
 #pragma once
+#include <cstdint>
 #include <optional>
+#include <string>
+#include <utility>
 
 namespace Intercom {
+// Kernel view of a TCP connection, used to estimate congestion without any help from the peer.
+struct TcpTransportInfo {
+    uint32_t rtt_us;
+    uint32_t rtt_var_us;
+    uint32_t total_retransmits;
+    uint32_t mss;
+};
+
 class TcpConnection {
     friend class TcpConnectionListener;
     int m_sockfd;
@@ -17,11 +28,18 @@ public:
     TcpConnection& operator=(const TcpConnection&) = delete;
     TcpConnection(TcpConnection&& other);
     TcpConnection& operator=(TcpConnection&& other);
+    // Reads exactly length bytes. Returns ECONNRESET if the peer hangs up first.
     std::pair<uint64_t, int> read(uint8_t* buffer, size_t length) const;
-    // A non-blocking read that returns immediately if no data is available.
+    // A non-blocking read that returns immediately (EWOULDBLOCK) if no data is available.
     std::pair<uint64_t, int> read_once(uint8_t* buffer, size_t length) const;
     std::pair<uint64_t, int> write(const uint8_t* buffer, size_t length) const;
     bool set_non_blocking();
+    // Caps data the kernel holds unsent: the socket only polls writable below bytes, so a backlog
+    // stays with the caller instead of piling up behind a slow link.
+    bool set_unsent_limit(int bytes) const;
+    // Makes blocking reads give up with EWOULDBLOCK after timeout_ms; 0 waits forever.
+    bool set_receive_timeout(int timeout_ms) const;
+    std::optional<TcpTransportInfo> transport_info() const;
     int socket() const { return m_sockfd; }
 };
 
@@ -0,0 +1,79 @@
+// Measures the per-frame cost of sealing and opening audio frames with ChaCha20-Poly1305.
+// Checks the RFC 8439 section 2.8.2 test vector first so a fast but wrong build doesn't pass.
+#include "ChaCha20Poly1305.h"
+
+#include <chrono>
+#include <cstring>
+#include <stdio.h>
+
+static bool check_rfc8439_vector()
+{
+    uint8_t key[32];
+    for (int i = 0; i < 32; i++) {
+        key[i] = (uint8_t)(0x80 + i);
+    }
+    const uint8_t nonce[12] = { 0x07, 0x00, 0x00, 0x00, 0x40, 0x41, 0x42, 0x43, 0x44, 0x45, 0x46, 0x47 };
+    const uint8_t aad[12] = { 0x50, 0x51, 0x52, 0x53, 0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7 };
+    const uint8_t expected_tag[16] = { 0x1a, 0xe1, 0x0b, 0x59, 0x4f, 0x09, 0xe2, 0x6a, 0x7e, 0x90, 0x2e, 0xcb, 0xd0,
+        0x60, 0x06, 0x91 };
+    const char plaintext[] = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the "
+                             "future, sunscreen would be it.";
+
+    uint8_t data[sizeof(plaintext) - 1];
+    memcpy(data, plaintext, sizeof(data));
+    Intercom::ChaCha20Poly1305 aead(key);
+    uint8_t tag[16];
+    aead.seal(nonce, aad, sizeof(aad), data, sizeof(data), tag);
+    if (memcmp(tag, expected_tag, sizeof(tag)) != 0) {
+        return false;
+    }
+    return aead.open(nonce, aad, sizeof(aad), data, sizeof(data), tag) && memcmp(data, plaintext, sizeof(data)) == 0;
+}
+
+static void bench(size_t frame_size, int iterations)
+{
+    uint8_t key[32] = { 1 };
+    uint8_t nonce[12] = {};
+    uint8_t aad[2] = { (uint8_t)(frame_size >> 8), (uint8_t)frame_size };
+    uint8_t frame[8192] = {};
+    uint8_t tag[16];
+    Intercom::ChaCha20Poly1305 aead(key);
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        memcpy(nonce + 4, &i, sizeof(i));
+        aead.seal(nonce, aad, sizeof(aad), frame, frame_size, tag);
+    }
+    const double seal_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    // Open a copy of one sealed frame each round; the copy is cheap next to the crypto.
+    uint8_t sealed[8192];
+    memcpy(sealed, frame, frame_size);
+    bool ok = true;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        memcpy(frame, sealed, frame_size);
+        ok &= aead.open(nonce, aad, sizeof(aad), frame, frame_size, tag);
+    }
+    const double open_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    printf("%5zu bytes: seal %7.2f us/frame (%7.1f MB/s), open %7.2f us/frame%s\n", frame_size,
+        seal_ns / iterations / 1000, (frame_size * (double)iterations) / (seal_ns / 1e9) / 1e6,
+        open_ns / iterations / 1000, ok ? "" : " [OPEN FAILED]");
+}
+
+int main()
+{
+    if (!check_rfc8439_vector()) {
+        fprintf(stderr, "ChaCha20-Poly1305 does not match the RFC 8439 test vector\n");
+        return 1;
+    }
+    printf("RFC 8439 test vector: ok\n");
+
+    // 2048 bytes is one 1024-sample int16 chunk, the size main.cpp sends.
+    const size_t frame_sizes[] = { 64, 512, 2048, 8192 };
+    for (size_t frame_size : frame_sizes) {
+        bench(frame_size, 20000);
+    }
+    return 0;
+}
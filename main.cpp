@@ -1,6 +1,11 @@
+#include "FramePacer.h"
+#include "SecureSession.h"
+#include "SessionReceiver.h"
 #include "TcpConnection.h"
 
 #include <portaudio.h>
+#include <cstdlib>
+#include <cstring>
 #include <stdio.h>
 #include <iostream>
 #include <unistd.h>
@@ -9,6 +14,10 @@
 #define CHUNK_SIZE 1024
 #define SAMPLE_RATE 44100
 #define TCP_PORT 6879
+#define LATENCY_TARGET_MS 150
+#define MEDIA_BITRATE (SAMPLE_RATE * 16)
+#define MIN_BITRATE (MEDIA_BITRATE / 8)
+#define MAX_BITRATE (MEDIA_BITRATE * 5 / 4) // headroom so the pacer can drain a backlog
 
 int recordCallback(const void* inputBuffer, void* outputBuffer, unsigned long framesPerBuffer,
     const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags statusFlags, void* userData)
@@ -19,15 +28,9 @@ int recordCallback(const void* inputBuffer, void* outputBuffer, unsigned long fr
     if (inputBuffer == nullptr) {
         return paContinue; // No input data
     }
-    auto* connection = static_cast<Intercom::TcpConnection*>(userData);
-    auto [written, err] = connection->write((uint8_t*)inputBuffer, framesPerBuffer * sizeof(int16_t));
-    if (err == EWOULDBLOCK) {
-        return paContinue; // Socket is full, continue recording
-    }
-    if (err != 0) {
-        printf("Error writing to socket: %s\n", strerror(err));
-        return paComplete; // Stop recording on error
-    }
+    // Never touch the socket from the audio thread; the pacer sends (or drops) the chunk later.
+    auto* pacer = static_cast<Intercom::FramePacer*>(userData);
+    pacer->push(static_cast<const uint8_t*>(inputBuffer), framesPerBuffer * sizeof(int16_t));
     return paContinue;
 }
 
@@ -37,24 +40,16 @@ int playCallback(const void* inputBuffer, void* outputBuffer, unsigned long fram
     (void)inputBuffer; // Prevent unused variable warning
     (void)timeInfo;
     (void)statusFlags;
-    auto* connection = static_cast<Intercom::TcpConnection*>(userData);
-    auto [read, err] = connection->read_once(static_cast<uint8_t*>(outputBuffer), framesPerBuffer * sizeof(int16_t));
-    if (err == EWOULDBLOCK) {
-        memset(outputBuffer, 0, framesPerBuffer * sizeof(int16_t)); // Fill with silence
-        return paContinue;                                          // No data available
-    }
-    if (err != 0) {
-        printf("Error reading from socket: %s\n", strerror(err));
-        return paComplete; // Stop playback on error
-    }
-
-    if (read == 0) {                                                // other side closed the connection
+    // The receive thread owns the socket; playback only drains what it has queued.
+    auto* receiver = static_cast<Intercom::SessionReceiver*>(userData);
+    size_t read = receiver->read_audio(static_cast<uint8_t*>(outputBuffer), framesPerBuffer * sizeof(int16_t));
+    if (!receiver->connected()) {                                   // other side closed the connection
         memset(outputBuffer, 0, framesPerBuffer * sizeof(int16_t)); // Fill with silence
         return paComplete;                                          // Stop playback
     }
 
     // Fill the rest of the output buffer with silence
-    if ((size_t)read < framesPerBuffer * sizeof(int16_t)) {
+    if (read < framesPerBuffer * sizeof(int16_t)) {
         memset(static_cast<uint8_t*>(outputBuffer) + read, 0, (framesPerBuffer * sizeof(int16_t)) - read);
     }
     return paContinue; // Continue playback
@@ -95,7 +90,7 @@ public:
 
     IntercomAudio& operator=(IntercomAudio&&) = delete;
 
-    static std::optional<IntercomAudio> create(Intercom::TcpConnection& connection)
+    static std::optional<IntercomAudio> create(Intercom::SessionReceiver& receiver, Intercom::FramePacer& pacer)
     {
         PaStreamParameters inputParameters;
         inputParameters.device = Pa_GetDefaultInputDevice();
@@ -106,7 +101,7 @@ public:
 
         PaStream* rec_stream;
         auto err = Pa_OpenStream(
-            &rec_stream, &inputParameters, nullptr, SAMPLE_RATE, CHUNK_SIZE, paClipOff, recordCallback, &connection);
+            &rec_stream, &inputParameters, nullptr, SAMPLE_RATE, CHUNK_SIZE, paClipOff, recordCallback, &pacer);
         if (err != paNoError) {
             printf("Error opening recording stream: %s\n", Pa_GetErrorText(err));
             return std::nullopt;
@@ -121,7 +116,7 @@ public:
 
         PaStream* play_stream;
         err = Pa_OpenStream(
-            &play_stream, nullptr, &outputParameters, SAMPLE_RATE, CHUNK_SIZE, paClipOff, playCallback, &connection);
+            &play_stream, nullptr, &outputParameters, SAMPLE_RATE, CHUNK_SIZE, paClipOff, playCallback, &receiver);
         if (err != paNoError) {
             printf("Error opening playback stream: %s\n", Pa_GetErrorText(err));
             return std::nullopt;
@@ -185,7 +180,7 @@ int extract_pid(std::string message)
     return pid;
 }
 
-std::string dicover_peer(bool& should_listen)
+std::string dicover_peer(const Intercom::SessionKey& key, bool& should_listen)
 {
     constexpr uint16_t kBroadcastPort = 55430;
     auto optSocket = Intercom::UdpSocket::create(kBroadcastPort);
@@ -194,26 +189,41 @@ std::string dicover_peer(bool& should_listen)
     char outgoing_message[256];
     const auto pid = getpid();
     snprintf(outgoing_message, sizeof(outgoing_message), broadcast_message, pid);
+    uint8_t outgoing_packet[256 + Intercom::kDiscoveryOverhead];
+    const size_t outgoing_length = strlen(outgoing_message);
+    memcpy(outgoing_packet, outgoing_message, outgoing_length);
     std::string peer_ip_address;
     if (!optSocket) {
         printf("Failed to create UDP socket\n");
         return peer_ip_address;
     }
     auto& broadcastSocket = *optSocket;
+    Intercom::DiscoveryVerifier verifier(key);
 
     while (true) {
-        broadcastSocket.broadcast((uint8_t*)outgoing_message, strlen(outgoing_message));
+        // Fresh nonce for every broadcast
+        size_t packet_length = Intercom::sign_discovery(key, outgoing_packet, outgoing_length, sizeof(outgoing_packet));
+        if (packet_length == 0) {
+            printf("Failed to sign broadcast\n");
+            return peer_ip_address;
+        }
+        broadcastSocket.broadcast(outgoing_packet, packet_length);
         sleep(1); // Wait for 5 seconds before sending the next broadcast
         std::string sender_address;
-        char incoming_msg[256];
-        auto [read, err] = broadcastSocket.receive_from((uint8_t*)incoming_msg, sizeof(incoming_msg), sender_address);
+        char incoming_msg[256 + Intercom::kDiscoveryOverhead];
+        auto [read, err] = broadcastSocket.receive_from((uint8_t*)incoming_msg, sizeof(incoming_msg) - 1, sender_address);
         if (err != 0) {
             printf("Error receiving broadcast: %s\n", strerror(err));
             continue;
         }
 
         if (read > 0) {
-            incoming_msg[read] = '\0'; // Null-terminate the received string
+            // Drop anything not signed with our key, stale or replayed
+            size_t msg_length = verifier.verify((uint8_t*)incoming_msg, read);
+            if (msg_length == 0) {
+                continue;
+            }
+            incoming_msg[msg_length] = '\0'; // Null-terminate the received string
             // Ignore my own message
             if (strcmp(incoming_msg, outgoing_message) == 0) {
                 continue;
@@ -241,8 +251,15 @@ std::string dicover_peer(bool& should_listen)
 
 int main()
 {
+    const char* key_hex = getenv("INTERCOM_KEY");
+    auto optKey = key_hex ? Intercom::parse_session_key(key_hex) : std::nullopt;
+    if (!optKey) {
+        fprintf(stderr, "Set INTERCOM_KEY to the same 64 hex digit key on both peers (e.g. openssl rand -hex 32)\n");
+        return -1;
+    }
+
     bool should_listen = false;
-    std::string peer_ip_address = dicover_peer(should_listen);
+    std::string peer_ip_address = dicover_peer(*optKey, should_listen);
     if (peer_ip_address.empty()) {
         fprintf(stderr, "Failed to discover peer\n");
         return -1;
@@ -269,12 +286,10 @@ int main()
             printf("Failed to accept connection\n");
             return -1;
         }
-        optConn->set_non_blocking();
         connection = std::move(*optConn);
     } else {
         printf("Connecting to [%s]...\n", peer_ip_address.c_str());
         if (auto optConn = Intercom::TcpConnection::connect(peer_ip_address.c_str(), TCP_PORT); optConn) {
-            optConn->set_non_blocking();
             connection = std::move(*optConn);
         } else {
             printf("Failed to connect to [%s]\n", peer_ip_address.c_str());
@@ -282,7 +297,28 @@ int main()
         }
     }
 
-    auto optIntercomAudio = IntercomAudio::create(*connection);
+    // The connector initiates the handshake
+    auto optSession = Intercom::SecureSession::handshake(*connection, *optKey, !should_listen);
+    if (!optSession) {
+        printf("Failed to establish a secure session\n");
+        return -1;
+    }
+    connection->set_non_blocking();
+
+    const Intercom::AudioFormat format { SAMPLE_RATE, 1, 16 };
+    Intercom::LinkStats linkStats;
+    Intercom::SessionReceiver receiver(*connection, *optSession, linkStats, format, LATENCY_TARGET_MS);
+    receiver.start();
+
+    Intercom::RateController rateController(MIN_BITRATE, MAX_BITRATE, LATENCY_TARGET_MS);
+    Intercom::FramePacer pacer(*connection, rateController, *optSession, linkStats);
+    pacer.start();
+    Intercom::ControlMessage formatMessage {};
+    formatMessage.type = Intercom::ControlType::AudioFormat;
+    formatMessage.format = format;
+    pacer.post_control(formatMessage);
+
+    auto optIntercomAudio = IntercomAudio::create(receiver, pacer);
     if (!optIntercomAudio) {
         printf("Failed to create audio streams\n");
         return -1;
@@ -309,8 +345,14 @@ int main()
                 intercomAudio.start_recording();
             }
             recording = !recording;
+            Intercom::ControlMessage talkMessage {};
+            talkMessage.type = Intercom::ControlType::Talk;
+            talkMessage.talking = recording;
+            pacer.post_control(talkMessage);
         } else if (ch == 'q') {
             optIntercomAudio.reset();
+            pacer.stop();
+            receiver.stop();
             break;
         }
     }
@@ -0,0 +1,377 @@
+// Headless soak test. Runs many sender/receiver sessions on loopback, each through its own
+// ImpairmentProxy, using the same pacing, rate control and encryption as the real app, with
+// synthetic audio in place of PortAudio. Prints latency percentiles, underruns, concealment and
+// memory growth, and exits non-zero if any of them breaks its threshold.
+//
+//     intercom_soak --sessions 8 --duration 3600 --seed 7 --script "0:delay=30,jitter=10;60:loss=0.02,burst=3;120:repeat"
+#include "FramePacer.h"
+#include "ImpairmentProxy.h"
+#include "RateController.h"
+#include "SecureSession.h"
+#include "SessionReceiver.h"
+#include "TcpConnection.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <stdio.h>
+#include <sys/random.h>
+#include <sys/resource.h>
+#include <thread>
+#include <vector>
+
+#define CHUNK_SIZE 1024
+#define SAMPLE_RATE 44100
+#define LATENCY_TARGET_MS 150
+#define MEDIA_BITRATE (SAMPLE_RATE * 16)
+#define MIN_BITRATE (MEDIA_BITRATE / 8)
+#define MAX_BITRATE (MEDIA_BITRATE * 5 / 4)
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr size_t kChunkBytes = CHUNK_SIZE * sizeof(int16_t);
+static constexpr auto kChunkPeriod = std::chrono::duration_cast<Clock::duration>(
+    std::chrono::duration<double>((double)CHUNK_SIZE / SAMPLE_RATE));
+static constexpr size_t kLatencyBuckets = 10000; // 1 ms each
+static constexpr Intercom::AudioFormat kFormat { SAMPLE_RATE, 1, 16 };
+
+struct Options {
+    int sessions = 4;
+    double duration_s = 60;
+    uint64_t seed = 1;
+    const char* script = "0:delay=20,jitter=5;20:loss=0.01,burst=3;40:rate=800000,spike=150,spike_prob=0.005;60:repeat";
+    uint16_t base_port = 47000;
+    double max_p99_ms = 400;
+    double max_underrun_rate = 0.05;
+    double max_concealment = 0.05;
+    long max_memory_growth_kb = 4096;
+};
+
+// Stamped into the first bytes of every synthetic chunk.
+struct ChunkHeader {
+    uint32_t sequence;
+    int64_t sent_ns;
+};
+
+struct SessionStats {
+    std::vector<uint64_t> latency_histogram = std::vector<uint64_t>(kLatencyBuckets);
+    uint64_t ticks = 0;
+    uint64_t underruns = 0;
+    uint64_t played_bytes = 0;
+    uint64_t silence_bytes = 0;
+    uint64_t lost_chunks = 0; // dropped by the sender's pacer or skipped by the receiver to catch up
+    uint64_t pacer_drops = 0; // counted by the sender's pacer, tail included, so not a subset of lost_chunks
+    uint64_t chunks = 0;
+    bool failed = false;
+
+    void merge(const SessionStats& other)
+    {
+        for (size_t i = 0; i < kLatencyBuckets; i++) {
+            latency_histogram[i] += other.latency_histogram[i];
+        }
+        ticks += other.ticks;
+        underruns += other.underruns;
+        played_bytes += other.played_bytes;
+        silence_bytes += other.silence_bytes;
+        lost_chunks += other.lost_chunks;
+        pacer_drops += other.pacer_drops;
+        chunks += other.chunks;
+        failed |= other.failed;
+    }
+
+    double latency_percentile(double p) const
+    {
+        uint64_t total = 0;
+        for (auto count : latency_histogram) {
+            total += count;
+        }
+        uint64_t target = (uint64_t)(p * total), seen = 0;
+        for (size_t i = 0; i < kLatencyBuckets; i++) {
+            seen += latency_histogram[i];
+            if (seen > target) {
+                return (double)i;
+            }
+        }
+        return (double)kLatencyBuckets;
+    }
+};
+
+static long peak_rss_kb()
+{
+    rusage usage {};
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return usage.ru_maxrss / 1024; // bytes on macOS
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+static void run_sender(uint16_t proxy_port, const Intercom::SessionKey& key, Clock::time_point deadline, SessionStats& stats)
+{
+    auto connection = Intercom::TcpConnection::connect("127.0.0.1", proxy_port);
+    if (!connection) {
+        stats.failed = true;
+        return;
+    }
+    auto session = Intercom::SecureSession::handshake(*connection, key, true);
+    if (!session) {
+        stats.failed = true;
+        return;
+    }
+    connection->set_non_blocking();
+
+    // Both ends run the full duplex stack so Stats from the receiver reach this pacer's controller.
+    Intercom::LinkStats link;
+    Intercom::SessionReceiver receiver(*connection, *session, link, kFormat, LATENCY_TARGET_MS);
+    receiver.start();
+    Intercom::RateController controller(MIN_BITRATE, MAX_BITRATE, LATENCY_TARGET_MS);
+    Intercom::FramePacer pacer(*connection, controller, *session, link);
+    pacer.start();
+    Intercom::ControlMessage message {};
+    message.type = Intercom::ControlType::AudioFormat;
+    message.format = kFormat;
+    pacer.post_control(message);
+    message.type = Intercom::ControlType::Talk;
+    message.talking = true;
+    pacer.post_control(message);
+
+    uint8_t chunk[kChunkBytes];
+    for (size_t i = 0; i < kChunkBytes; i++) {
+        chunk[i] = (uint8_t)i;
+    }
+    uint32_t sequence = 0;
+    for (auto tick = Clock::now(); tick < deadline; tick += kChunkPeriod) {
+        std::this_thread::sleep_until(tick);
+        // The receiver holds the connection open until the deadline, so losing it before then is a failure.
+        if (!receiver.connected() || pacer.last_error() != 0) {
+            const int err = pacer.last_error() != 0 ? pacer.last_error() : receiver.last_error();
+            fprintf(stderr, "soak - Sender lost its connection: %s\n", strerror(err));
+            stats.failed = true;
+            break;
+        }
+        ChunkHeader header { sequence++, Clock::now().time_since_epoch().count() };
+        memcpy(chunk, &header, sizeof(header));
+        pacer.push(chunk, sizeof(chunk)); // chunks the pacer drops show up as sequence gaps at the receiver
+    }
+    // Let the tail drain before hanging up
+    std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(2 * controller.latency_target_ms()));
+    pacer.stop();
+    receiver.stop();
+    stats.pacer_drops = pacer.dropped_chunks();
+}
+
+// Plays out received audio at the device rate, like playCallback, and measures what a listener hears.
+static void run_receiver(Intercom::TcpConnectionListener& listener, const Intercom::SessionKey& key,
+    Clock::time_point deadline, SessionStats& stats)
+{
+    auto connection = listener.accept();
+    if (!connection) {
+        stats.failed = true;
+        return;
+    }
+    auto session = Intercom::SecureSession::handshake(*connection, key, false);
+    if (!session) {
+        stats.failed = true;
+        return;
+    }
+    connection->set_non_blocking();
+
+    Intercom::LinkStats link;
+    Intercom::SessionReceiver receiver(*connection, *session, link, kFormat, LATENCY_TARGET_MS);
+    receiver.start();
+    Intercom::RateController controller(MIN_BITRATE, MAX_BITRATE, LATENCY_TARGET_MS);
+    Intercom::FramePacer pacer(*connection, controller, *session, link); // only sends control back
+    pacer.start();
+
+    uint8_t assembly[kChunkBytes];
+    size_t assembled = 0;
+    uint32_t expected_sequence = 0;
+    bool started = false;
+    for (auto tick = Clock::now(); tick < deadline; tick += kChunkPeriod) {
+        std::this_thread::sleep_until(tick);
+        uint8_t output[kChunkBytes];
+        const size_t read = receiver.read_audio(output, sizeof(output));
+        if (!receiver.connected()) {
+            // Any disconnect before the deadline, a hangup included, cuts the session short.
+            fprintf(stderr, "soak - Receive failed: %s\n", strerror(receiver.last_error()));
+            stats.failed = true;
+            break;
+        }
+        if (!started && read == 0) {
+            continue; // Nothing to conceal before the first chunk arrives
+        }
+        started = true;
+        stats.ticks++;
+        stats.played_bytes += sizeof(output);
+        if (read < sizeof(output)) {
+            stats.underruns++;
+            stats.silence_bytes += sizeof(output) - read;
+        }
+
+        // Reassemble sender chunks from the byte stream to find out when each one was captured.
+        const auto now_ns = Clock::now().time_since_epoch().count();
+        for (size_t offset = 0; offset < read;) {
+            const size_t n = std::min(read - offset, kChunkBytes - assembled);
+            memcpy(assembly + assembled, output + offset, n);
+            assembled += n;
+            offset += n;
+            if (assembled < kChunkBytes) {
+                break;
+            }
+            assembled = 0;
+            ChunkHeader header;
+            memcpy(&header, assembly, sizeof(header));
+            stats.lost_chunks += header.sequence - expected_sequence;
+            expected_sequence = header.sequence + 1;
+            stats.chunks++;
+            const size_t latency_ms = (size_t)((now_ns - header.sent_ns) / 1000000);
+            stats.latency_histogram[std::min(latency_ms, kLatencyBuckets - 1)]++;
+        }
+    }
+    std::this_thread::sleep_until(deadline); // Don't hang up on a sender that's still going
+    pacer.stop();
+    receiver.stop();
+}
+
+static bool parse_options(int argc, char** argv, Options& options)
+{
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        const char* value = i + 1 < argc ? argv[i + 1] : nullptr;
+        if (value == nullptr) {
+            return false;
+        }
+        i++;
+        if (strcmp(arg, "--sessions") == 0) {
+            options.sessions = atoi(value);
+        } else if (strcmp(arg, "--duration") == 0) {
+            options.duration_s = atof(value);
+        } else if (strcmp(arg, "--seed") == 0) {
+            options.seed = strtoull(value, nullptr, 10);
+        } else if (strcmp(arg, "--script") == 0) {
+            options.script = value;
+        } else if (strcmp(arg, "--port") == 0) {
+            options.base_port = (uint16_t)atoi(value);
+        } else if (strcmp(arg, "--max-p99-ms") == 0) {
+            options.max_p99_ms = atof(value);
+        } else if (strcmp(arg, "--max-underrun-rate") == 0) {
+            options.max_underrun_rate = atof(value);
+        } else if (strcmp(arg, "--max-concealment") == 0) {
+            options.max_concealment = atof(value);
+        } else if (strcmp(arg, "--max-memory-growth-kb") == 0) {
+            options.max_memory_growth_kb = atol(value);
+        } else {
+            return false;
+        }
+    }
+    return options.sessions > 0 && options.duration_s > 0;
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        fprintf(stderr,
+            "usage: %s [--sessions N] [--duration SECONDS] [--seed N] [--script SCRIPT] [--port BASE]\n"
+            "          [--max-p99-ms MS] [--max-underrun-rate R] [--max-concealment R] [--max-memory-growth-kb KB]\n",
+            argv[0]);
+        return 2;
+    }
+    auto script = Intercom::ImpairmentScript::parse(options.script);
+    if (!script) {
+        return 2;
+    }
+
+    // Receivers hang up at the deadline while senders are still draining
+    signal(SIGPIPE, SIG_IGN);
+
+    Intercom::SessionKey key;
+    if (getentropy(key.data(), key.size()) != 0) {
+        fprintf(stderr, "soak - Failed to generate key: %s\n", strerror(errno));
+        return 2;
+    }
+
+    // Each session: receiver listens on base + 2i, its proxy on base + 2i + 1.
+    std::vector<Intercom::TcpConnectionListener> listeners;
+    std::vector<Intercom::ImpairmentProxy> proxies;
+    for (int i = 0; i < options.sessions; i++) {
+        const uint16_t receiver_port = (uint16_t)(options.base_port + (2 * i));
+        auto listener = Intercom::TcpConnectionListener::listen(receiver_port);
+        auto proxy = Intercom::ImpairmentProxy::create(
+            receiver_port + 1, "127.0.0.1", receiver_port, *script, options.seed + (uint64_t)i);
+        if (!listener || !proxy) {
+            fprintf(stderr, "soak - Failed to set up session %d\n", i);
+            return 2;
+        }
+        listeners.push_back(std::move(*listener));
+        proxies.push_back(std::move(*proxy));
+    }
+
+    const auto start = Clock::now();
+    const auto deadline = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.duration_s));
+    std::atomic<bool> running = true;
+    std::vector<SessionStats> stats(options.sessions);
+    std::vector<SessionStats> sender_stats(options.sessions);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < options.sessions; i++) {
+        const uint16_t proxy_port = (uint16_t)(options.base_port + (2 * i) + 1);
+        threads.emplace_back([&, i] { proxies[i].relay(running); });
+        threads.emplace_back([&, i] { run_receiver(listeners[i], key, deadline, stats[i]); });
+        threads.emplace_back([&, i, proxy_port] { run_sender(proxy_port, key, deadline, sender_stats[i]); });
+    }
+
+    // Memory is baselined once every session is up and buffers have reached steady state.
+    const auto warmup = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(
+                            std::min(10.0, options.duration_s / 10)));
+    std::this_thread::sleep_until(warmup);
+    const long baseline_rss_kb = peak_rss_kb();
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    running = false;
+    const long memory_growth_kb = peak_rss_kb() - baseline_rss_kb;
+
+    SessionStats total;
+    for (int i = 0; i < options.sessions; i++) {
+        total.merge(stats[i]);
+        total.merge(sender_stats[i]);
+    }
+
+    const double p50 = total.latency_percentile(0.50);
+    const double p95 = total.latency_percentile(0.95);
+    const double p99 = total.latency_percentile(0.99);
+    const double underrun_rate = total.ticks ? (double)total.underruns / total.ticks : 1.0;
+    const double lost_bytes = (double)total.lost_chunks * kChunkBytes;
+    const double concealment = total.played_bytes ? (total.silence_bytes + lost_bytes) / (total.played_bytes + lost_bytes) : 1.0;
+
+    printf("sessions %d, duration %.0fs, seed %llu\n", options.sessions, options.duration_s,
+        (unsigned long long)options.seed);
+    printf("script: %s\n", options.script);
+    printf("latency ms: p50 %.0f, p95 %.0f, p99 %.0f\n", p50, p95, p99);
+    printf("chunks: %llu played, %llu lost or skipped, %llu dropped by the sender's pacer\n",
+        (unsigned long long)total.chunks, (unsigned long long)total.lost_chunks, (unsigned long long)total.pacer_drops);
+    printf("underruns: %llu of %llu ticks (%.2f%%)\n", (unsigned long long)total.underruns,
+        (unsigned long long)total.ticks, underrun_rate * 100);
+    printf("concealment: %.2f%%\n", concealment * 100);
+    printf("memory growth: %ld KB\n", memory_growth_kb);
+
+    bool pass = true;
+    auto check = [&pass](bool ok, const char* what) {
+        if (!ok) {
+            printf("FAIL: %s\n", what);
+            pass = false;
+        }
+    };
+    check(!total.failed, "a session failed to connect or lost its connection");
+    check(p99 <= options.max_p99_ms, "p99 latency above threshold");
+    check(underrun_rate <= options.max_underrun_rate, "underrun rate above threshold");
+    check(concealment <= options.max_concealment, "concealment rate above threshold");
+    check(memory_growth_kb <= options.max_memory_growth_kb, "memory growth above threshold");
+    printf("%s\n", pass ? "PASS" : "FAIL");
+    return pass ? 0 : 1;
+}